@@ -0,0 +1,332 @@
+#define NS_PRIVATE_IMPLEMENTATION
+#define CA_PRIVATE_IMPLEMENTATION
+#define MTL_PRIVATE_IMPLEMENTATION
+
+#include <Metal/Metal.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <vector>
+
+#include <ExecutionBackend.hpp>
+#include <IMatrix.hpp>
+#include <MetalSparseMatrix.hpp>
+#include <ParallelSparseMatrix.hpp>
+#include <PerfCounters.hpp>
+#include <PersistencePairs.hpp>
+#include <SparseMatrix.hpp>
+
+// Loads a matrix once, reduces it a number of times with every selected
+// engine, each time from a fresh copy of its columns, and prints timing
+// statistics and pair checksums as JSON.
+
+// FNV-1a over the pairs in the order they arrive, which is the same for
+// every engine.
+class ChecksumSink : public PairSink {
+    public:
+        void addPair(uint64_t birth, uint64_t death) override {
+            mix(birth);
+            mix(death);
+            pairs_++;
+        }
+
+        uint64_t checksum() const { return hash_; }
+
+        size_t pairs() const { return pairs_; }
+
+    private:
+        void mix(uint64_t value) {
+            for (int byte = 0; byte < 8; byte++) {
+                hash_ ^= (value >> (8 * byte)) & 0xff;
+                hash_ *= 0x100000001b3;
+            }
+        }
+
+        uint64_t hash_ = 0xcbf29ce484222325;
+        size_t pairs_ = 0;
+};
+
+struct RunResult {
+        double wall_seconds;
+        double cpu_seconds;
+        std::map<std::string, double> phase_seconds;
+        uint64_t checksum;
+        size_t pairs;
+};
+
+struct Summary {
+        double min;
+        double median;
+        double p95;
+};
+
+Summary summarize(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    // Nearest rank.
+    auto rank = [&](double q) {
+        size_t index = (size_t)(q * values.size() + 0.999999);
+        return values[std::max<size_t>(index, 1) - 1];
+    };
+    return {values.front(), rank(0.5), rank(0.95)};
+}
+
+double cpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Starts a new high-water mark of resident memory, which Linux allows
+// through clear_refs. Returns false if peakRssBytes keeps reporting the peak
+// of the whole process.
+bool resetPeakRss() {
+#ifdef __linux__
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    return clear_refs.is_open() && (clear_refs << "5").flush();
+#else
+    return false;
+#endif
+}
+
+uint64_t peakRssBytes() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+// Columns of the input file, in the layout CscSpan borrows.
+struct CscArrays {
+        size_t n = 0;
+        std::vector<uint64_t> col_ptr;
+        std::vector<uint64_t> row_index;
+
+        CscSpan<uint64_t, uint64_t> span() const {
+            return {n, col_ptr.data(), row_index.data()};
+        }
+};
+
+CscArrays readCsc(std::istream& input) {
+    CscArrays csc;
+    std::string line;
+    if (!std::getline(input, line)) {
+        throw std::runtime_error("Empty input");
+    }
+    csc.n = std::stoull(line);
+    csc.col_ptr.push_back(0);
+    while (csc.col_ptr.size() <= csc.n && std::getline(input, line)) {
+        std::istringstream iss(line);
+        uint64_t row;
+        while (iss >> row) {
+            csc.row_index.push_back(row);
+        }
+        csc.col_ptr.push_back(csc.row_index.size());
+    }
+    csc.col_ptr.resize(csc.n + 1, csc.row_index.size());
+    return csc;
+}
+
+std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+std::string jsonSummary(const Summary& summary) {
+    std::ostringstream out;
+    out << "{\"min\": " << summary.min << ", \"median\": " << summary.median
+        << ", \"p95\": " << summary.p95 << "}";
+    return out.str();
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream iss(list);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program
+              << " [--runs <count>] [--threads <count>] [--backend <name>] "
+                 "[--engines <engine,...>] <input file name>\n";
+    std::cout << "Engines: sparse sparse-twist sparse-parallel "
+                 "sparse-parallel-twist sparse-metal sparse-metal-twist\n";
+}
+
+int main(int argc, const char* argv[]) {
+    size_t runs = 5;
+    size_t num_threads = 0;
+    std::string backend_name = "threadpool";
+    std::vector<std::string> engines = {"sparse", "sparse-twist",
+                                        "sparse-parallel",
+                                        "sparse-parallel-twist"};
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc) {
+            runs = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            num_threads = std::stoul(argv[++i]);
+        } else if (arg == "--backend" && i + 1 < argc) {
+            backend_name = argv[++i];
+        } else if (arg == "--engines" && i + 1 < argc) {
+            engines = splitList(argv[++i]);
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cout << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::string input_path = positional[0];
+
+    std::ifstream file(input_path);
+    if (!file.is_open()) {
+        std::cerr << "Could not open " << input_path << "\n";
+        return 1;
+    }
+    CscArrays csc;
+    try {
+        csc = readCsc(file);
+    } catch (const std::exception& e) {
+        std::cerr << input_path << ": " << e.what() << "\n";
+        return 1;
+    }
+    PerfCounters::enable();
+
+    std::shared_ptr<ExecutionBackend> backend =
+        makeExecutionBackend(backend_name, num_threads);
+
+    size_t n = 0;
+    bool checksums_match = true;
+    uint64_t first_checksum = 0;
+    std::ostringstream engines_json;
+    for (size_t e = 0; e < engines.size(); e++) {
+        const std::string& engine = engines[e];
+        bool twist = engine.size() > 6 &&
+                     engine.compare(engine.size() - 6, 6, "-twist") == 0;
+        std::string base = twist ? engine.substr(0, engine.size() - 6) : engine;
+
+        bool engine_peak = resetPeakRss();
+        std::vector<RunResult> results;
+        for (size_t run = 0; run < runs; run++) {
+            std::unique_ptr<IMatrix> matrix;
+            if (base == "sparse") {
+                matrix = makeMatrix<SparseMatrix>(csc.span());
+            } else if (base == "sparse-parallel") {
+                matrix =
+                    makeMatrix<ParallelSparseMatrix>(csc.span(), backend);
+            } else if (base == "sparse-metal") {
+                // The Metal engine only loads from files.
+                matrix =
+                    std::make_unique<MetalSparseMatrix>(input_path, backend);
+            } else {
+                std::cerr << "Unknown engine: " << engine << "\n";
+                return 1;
+            }
+            n = matrix->size();
+
+            PerfCounters::reset();
+            ChecksumSink pairs;
+            double cpu_start = cpuSeconds();
+            auto start = std::chrono::steady_clock::now();
+            matrix->reduce(pairs, twist);
+            RunResult result;
+            result.wall_seconds = std::chrono::duration<double>(
+                                      std::chrono::steady_clock::now() - start)
+                                      .count();
+            result.cpu_seconds = cpuSeconds() - cpu_start;
+            for (const auto& [phase, counts] : PerfCounters::phaseCounts()) {
+                result.phase_seconds[phase] = counts.wall_seconds;
+            }
+            result.checksum = pairs.checksum();
+            result.pairs = pairs.pairs();
+            results.push_back(result);
+        }
+
+        std::vector<double> wall;
+        std::vector<double> cpu;
+        std::map<std::string, std::vector<double>> phases;
+        bool consistent = true;
+        for (const RunResult& result : results) {
+            wall.push_back(result.wall_seconds);
+            cpu.push_back(result.cpu_seconds);
+            for (const auto& [phase, seconds] : result.phase_seconds) {
+                phases[phase].push_back(seconds);
+            }
+            consistent &= result.checksum == results[0].checksum;
+        }
+        if (e == 0) {
+            first_checksum = results[0].checksum;
+        }
+        checksums_match &= consistent && results[0].checksum == first_checksum;
+
+        char checksum[17];
+        std::snprintf(checksum, sizeof(checksum), "%016llx",
+                      (unsigned long long)results[0].checksum);
+        engines_json << (e == 0 ? "" : ",") << "\n    {\"engine\": "
+                     << jsonString(engine)
+                     << ", \"wall_seconds\": " << jsonSummary(summarize(wall))
+                     << ", \"cpu_seconds\": " << jsonSummary(summarize(cpu))
+                     << ", \"phases\": {";
+        bool first_phase = true;
+        for (const auto& [phase, seconds] : phases) {
+            engines_json << (first_phase ? "" : ", ") << jsonString(phase)
+                         << ": " << jsonSummary(summarize(seconds));
+            first_phase = false;
+        }
+        // Without a reset, this is the peak of the process so far.
+        engines_json << "}, \"peak_rss_bytes\": " << peakRssBytes()
+                     << ", \"peak_rss_scope\": "
+                     << (engine_peak ? "\"engine\"" : "\"process\"")
+                     << ", \"pairs\": " << results[0].pairs
+                     << ", \"checksum\": \"" << checksum
+                     << "\", \"consistent\": "
+                     << (consistent ? "true" : "false") << "}";
+    }
+
+    std::cout << "{\n  \"input\": " << jsonString(input_path)
+              << ",\n  \"n\": " << n << ",\n  \"runs\": " << runs
+              << ",\n  \"backend\": " << jsonString(backend->name())
+              << ",\n  \"threads\": " << backend->concurrency()
+              << ",\n  \"engines\": [" << engines_json.str()
+              << "\n  ],\n  \"checksums_match\": "
+              << (checksums_match ? "true" : "false") << "\n}\n";
+    return checksums_match ? 0 : 1;
+}
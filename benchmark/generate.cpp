@@ -0,0 +1,633 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Writes boundary matrices of synthetic filtrations in the format the engines
+// read. Everything is drawn from one SplitMix64 stream, so a seed always gives
+// the same matrix.
+
+namespace {
+
+const uint64_t not_included = std::numeric_limits<uint64_t>::max();
+
+const double pi = 3.14159265358979323846;
+
+class SplitMix64 {
+    public:
+        SplitMix64(uint64_t seed) : state_(seed) {}
+
+        uint64_t next() {
+            uint64_t z = (state_ += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+        // In [0, 1).
+        double uniform() { return (next() >> 11) * 0x1.0p-53; }
+
+        double normal() {
+            double u = 1 - uniform();
+            double v = uniform();
+            return std::sqrt(-2 * std::log(u)) * std::cos(2 * pi * v);
+        }
+
+    private:
+        uint64_t state_;
+};
+
+class MatrixWriter {
+    public:
+        MatrixWriter(const std::string& path, uint64_t n) : file_(path) {
+            if (!file_.is_open()) {
+                throw std::runtime_error("Could not open " + path);
+            }
+            buffer_.reserve(1 << 20);
+            append(n);
+            buffer_ += '\n';
+        }
+
+        ~MatrixWriter() { flush(); }
+
+        void column(std::vector<uint64_t>& rows) {
+            std::sort(rows.begin(), rows.end());
+            for (size_t i = 0; i < rows.size(); i++) {
+                if (i > 0) {
+                    buffer_ += ' ';
+                }
+                append(rows[i]);
+            }
+            buffer_ += '\n';
+            nnz_ += rows.size();
+            if (buffer_.size() > (1 << 20) - 4096) {
+                flush();
+            }
+        }
+
+        uint64_t nnz() const { return nnz_; }
+
+    private:
+        void append(uint64_t value) {
+            char digits[24];
+            auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            buffer_.append(digits, result.ptr);
+        }
+
+        void flush() {
+            file_.write(buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+
+        std::ofstream file_;
+        std::string buffer_;
+        uint64_t nnz_ = 0;
+};
+
+// Position of a cell in the filtration: by value, then dimension, then id,
+// which keeps every face ahead of its cofaces.
+struct Cell {
+        double value;
+        uint32_t dim;
+        uint64_t id;
+
+        bool operator<(const Cell& other) const {
+            if (value != other.value) {
+                return value < other.value;
+            }
+            if (dim != other.dim) {
+                return dim < other.dim;
+            }
+            return id < other.id;
+        }
+};
+
+// The first n cells of the filtration form a subcomplex; returns them in
+// filtration order.
+std::vector<Cell> truncate(std::vector<Cell> cells, uint64_t n) {
+    std::sort(cells.begin(), cells.end());
+    cells.resize(std::min<uint64_t>(n, cells.size()));
+    return cells;
+}
+
+// Simplices of one dimension in lexicographic order, as dim + 1 sorted
+// vertices each.
+struct SimplexTable {
+        uint32_t dim;
+        std::vector<uint32_t> vertices;
+        std::vector<double> values;
+
+        size_t size() const { return values.size(); }
+
+        const uint32_t* at(size_t i) const {
+            return vertices.data() + i * (dim + 1);
+        }
+
+        size_t find(const uint32_t* simplex) const {
+            size_t low = 0;
+            size_t high = size();
+            while (low < high) {
+                size_t mid = (low + high) / 2;
+                if (std::lexicographical_compare(at(mid), at(mid) + dim + 1,
+                                                 simplex,
+                                                 simplex + dim + 1)) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            return low;
+        }
+};
+
+struct Neighbor {
+        uint32_t vertex;
+        double weight;
+};
+
+// Neighbors with a higher index, sorted by index.
+using Graph = std::vector<std::vector<Neighbor>>;
+
+// Enumerates the clique complex of graph up to max_dim, valued by the heaviest
+// edge. Returns false once it holds more than max_simplices simplices.
+bool buildCliques(const Graph& graph, uint32_t max_dim, uint64_t max_simplices,
+                  std::vector<SimplexTable>& tables) {
+    tables.assign(max_dim + 1, SimplexTable());
+    for (uint32_t d = 0; d <= max_dim; d++) {
+        tables[d].dim = d;
+    }
+    uint64_t count = 0;
+    std::vector<uint32_t> simplex;
+
+    // Depth first with increasing vertices, so that every table comes out in
+    // lexicographic order.
+    auto extend = [&](auto& self, double value,
+                      const std::vector<Neighbor>& candidates) -> bool {
+        uint32_t dim = simplex.size();
+        for (size_t c = 0; c < candidates.size(); c++) {
+            simplex.push_back(candidates[c].vertex);
+            double cur_value = std::max(value, candidates[c].weight);
+            tables[dim].vertices.insert(tables[dim].vertices.end(),
+                                        simplex.begin(), simplex.end());
+            tables[dim].values.push_back(cur_value);
+            if (++count > max_simplices) {
+                return false;
+            }
+
+            if (dim < max_dim) {
+                // Later candidates that are also adjacent to this one.
+                const std::vector<Neighbor>& adjacent =
+                    graph[candidates[c].vertex];
+                std::vector<Neighbor> next;
+                size_t a = 0;
+                for (size_t k = c + 1; k < candidates.size(); k++) {
+                    while (a < adjacent.size() &&
+                           adjacent[a].vertex < candidates[k].vertex) {
+                        a++;
+                    }
+                    if (a < adjacent.size() &&
+                        adjacent[a].vertex == candidates[k].vertex) {
+                        next.push_back(
+                            {candidates[k].vertex,
+                             std::max(candidates[k].weight,
+                                      adjacent[a].weight)});
+                    }
+                }
+                if (!next.empty() && !self(self, cur_value, next)) {
+                    return false;
+                }
+            }
+            simplex.pop_back();
+        }
+        return true;
+    };
+
+    for (uint32_t v = 0; v < graph.size(); v++) {
+        simplex.assign(1, v);
+        tables[0].vertices.push_back(v);
+        tables[0].values.push_back(0);
+        count++;
+        if (max_dim > 0 && !extend(extend, 0, graph[v])) {
+            return false;
+        }
+    }
+    return count <= max_simplices;
+}
+
+uint64_t writeSimplicial(const std::string& path, uint64_t n,
+                         const std::vector<SimplexTable>& tables) {
+    std::vector<Cell> cells;
+    std::vector<std::vector<uint64_t>> index(tables.size());
+    for (const SimplexTable& table : tables) {
+        for (size_t i = 0; i < table.size(); i++) {
+            cells.push_back({table.values[i], table.dim, i});
+        }
+        index[table.dim].assign(table.size(), not_included);
+    }
+    cells = truncate(std::move(cells), n);
+    for (size_t i = 0; i < cells.size(); i++) {
+        index[cells[i].dim][cells[i].id] = i;
+    }
+
+    MatrixWriter writer(path, cells.size());
+    std::vector<uint64_t> rows;
+    std::vector<uint32_t> facet;
+    for (const Cell& cell : cells) {
+        rows.clear();
+        if (cell.dim > 0) {
+            const uint32_t* simplex = tables[cell.dim].at(cell.id);
+            for (uint32_t skip = 0; skip <= cell.dim; skip++) {
+                facet.clear();
+                for (uint32_t k = 0; k <= cell.dim; k++) {
+                    if (k != skip) {
+                        facet.push_back(simplex[k]);
+                    }
+                }
+                const SimplexTable& faces = tables[cell.dim - 1];
+                rows.push_back(index[cell.dim - 1][faces.find(facet.data())]);
+            }
+        }
+        writer.column(rows);
+    }
+    return writer.nnz();
+}
+
+// Average degree at which a graph on points vertices has about n cliques of
+// dimension at most max_dim, as each vertex starts about
+// sum_j C(degree, j) / (j + 1) of them.
+uint64_t pointCount(uint64_t n, uint32_t max_dim, double degree) {
+    double per_vertex = 0;
+    double binomial = 1;
+    for (uint32_t j = 0; j <= max_dim; j++) {
+        per_vertex += binomial / (j + 1);
+        binomial *= (degree - j) / (j + 1);
+    }
+    return std::max<uint64_t>(max_dim + 2, n / per_vertex);
+}
+
+struct Point {
+        double x[3];
+};
+
+// Vietoris-Rips graph at radius, found through a grid of cells of that size.
+// Points of a flat torus live in [0, 1)^2 and wrap around.
+Graph ripsGraph(const std::vector<Point>& points, uint32_t dims, bool torus,
+                double radius) {
+    double low = torus ? 0 : -1;
+    size_t side = std::max<size_t>(1, (size_t)((torus ? 1 : 2) / radius));
+    auto cellOf = [&](double x) {
+        return std::min(side - 1, (size_t)((x - low) / (torus ? 1 : 2) * side));
+    };
+    auto distance = [&](const Point& a, const Point& b) {
+        double sum = 0;
+        for (uint32_t k = 0; k < dims; k++) {
+            double d = std::abs(a.x[k] - b.x[k]);
+            if (torus) {
+                d = std::min(d, 1 - d);
+            }
+            sum += d * d;
+        }
+        return std::sqrt(sum);
+    };
+
+    size_t cell_count = 1;
+    for (uint32_t k = 0; k < dims; k++) {
+        cell_count *= side;
+    }
+    std::vector<std::vector<uint32_t>> grid(cell_count);
+    std::vector<size_t> point_cell(points.size());
+    for (uint32_t p = 0; p < points.size(); p++) {
+        size_t cell = 0;
+        for (uint32_t k = 0; k < dims; k++) {
+            cell = cell * side + cellOf(points[p].x[k]);
+        }
+        point_cell[p] = cell;
+        grid[cell].push_back(p);
+    }
+
+    Graph graph(points.size());
+    for (uint32_t p = 0; p < points.size(); p++) {
+        size_t coords[3];
+        size_t cell = point_cell[p];
+        for (uint32_t k = dims; k-- > 0;) {
+            coords[k] = cell % side;
+            cell /= side;
+        }
+        // Up to 3^dims neighbouring cells, wrapping on the torus.
+        size_t neighbours = 1;
+        for (uint32_t k = 0; k < dims; k++) {
+            neighbours *= 3;
+        }
+        std::vector<size_t> visited;
+        for (size_t offset = 0; offset < neighbours; offset++) {
+            size_t other = 0;
+            bool inside = true;
+            for (uint32_t k = 0, rest = offset; k < dims; k++, rest /= 3) {
+                long coord = (long)coords[k] + (long)(rest % 3) - 1;
+                if (torus) {
+                    coord = (coord + side) % side;
+                } else if (coord < 0 || coord >= (long)side) {
+                    inside = false;
+                }
+                other = other * side + coord;
+            }
+            if (!inside || std::find(visited.begin(), visited.end(), other) !=
+                               visited.end()) {
+                continue;
+            }
+            visited.push_back(other);
+            for (uint32_t q : grid[other]) {
+                double d = q > p ? distance(points[p], points[q]) : radius;
+                if (d < radius) {
+                    graph[p].push_back({q, d});
+                }
+            }
+        }
+        std::sort(graph[p].begin(), graph[p].end(),
+                  [](const Neighbor& a, const Neighbor& b) {
+                      return a.vertex < b.vertex;
+                  });
+    }
+    return graph;
+}
+
+uint64_t generateRips(const std::string& path, uint64_t n, uint32_t max_dim,
+                      SplitMix64& random, bool torus, double degree) {
+    std::vector<Point> points(pointCount(n, max_dim, degree));
+    uint32_t dims = torus ? 2 : 3;
+    for (Point& point : points) {
+        if (torus) {
+            point.x[0] = random.uniform();
+            point.x[1] = random.uniform();
+        } else {
+            double norm = 0;
+            while (norm == 0) {
+                norm = 0;
+                for (double& x : point.x) {
+                    x = random.normal();
+                    norm += x * x;
+                }
+                norm = std::sqrt(norm);
+            }
+            for (double& x : point.x) {
+                x /= norm;
+            }
+        }
+    }
+
+    // Radius at which a point has about degree neighbours on average, grown
+    // until there are enough simplices.
+    double count = points.size();
+    double radius = torus ? std::sqrt(degree / (pi * count))
+                          : std::sqrt(4 * degree / count);
+    std::vector<SimplexTable> tables;
+    while (true) {
+        Graph graph = ripsGraph(points, dims, torus, radius);
+        buildCliques(graph, max_dim, std::numeric_limits<uint64_t>::max(),
+                     tables);
+        uint64_t total = 0;
+        for (const SimplexTable& table : tables) {
+            total += table.size();
+        }
+        if (total >= n || radius >= (torus ? 0.5 : 2)) {
+            break;
+        }
+        radius *= 1.25;
+    }
+    return writeSimplicial(path, n, tables);
+}
+
+uint64_t generateClique(const std::string& path, uint64_t n, uint32_t max_dim,
+                        SplitMix64& random, double degree) {
+    uint64_t count = pointCount(n, max_dim, degree);
+    std::vector<SimplexTable> tables;
+    while (true) {
+        // G(count, p) with uniform edge weights, by skipping over absent
+        // edges geometrically.
+        double p = std::min(1.0, degree / (count - 1));
+        Graph graph(count);
+        for (uint32_t v = 0; v + 1 < count; v++) {
+            uint64_t w = v;
+            while (true) {
+                if (p < 1) {
+                    double skip = std::floor(std::log(1 - random.uniform()) /
+                                             std::log(1 - p));
+                    w += 1 + (uint64_t)std::min(skip, (double)count);
+                } else {
+                    w++;
+                }
+                if (w >= count) {
+                    break;
+                }
+                graph[v].push_back({(uint32_t)w, random.uniform()});
+            }
+        }
+        // A denser graph is only needed if this one is short of n cliques.
+        if (buildCliques(graph, max_dim, n * 8, tables)) {
+            uint64_t total = 0;
+            for (const SimplexTable& table : tables) {
+                total += table.size();
+            }
+            if (total >= n || p == 1) {
+                break;
+            }
+            degree *= 1.25;
+        } else {
+            degree /= 1.25;
+        }
+    }
+    return writeSimplicial(path, n, tables);
+}
+
+// Cubical complex of a dims-dimensional noise image, valued by the brightest
+// vertex of every cube. A cell is a vertex plus a mask of the axes it extends
+// along; its id is vertex * 2^dims + mask.
+uint64_t generateCubical(const std::string& path, uint64_t n, uint32_t dims,
+                         SplitMix64& random) {
+    uint64_t side = 2;
+    while (std::pow(2.0 * side - 1, dims) < n) {
+        side++;
+    }
+    std::vector<uint64_t> stride(dims);
+    uint64_t vertex_count = 1;
+    for (uint32_t k = 0; k < dims; k++) {
+        stride[k] = vertex_count;
+        vertex_count *= side;
+    }
+    std::vector<double> image(vertex_count);
+    for (double& value : image) {
+        value = random.uniform();
+    }
+
+    uint32_t masks = 1 << dims;
+    std::vector<Cell> cells;
+    for (uint64_t v = 0; v < vertex_count; v++) {
+        for (uint32_t mask = 0; mask < masks; mask++) {
+            bool inside = true;
+            for (uint32_t k = 0; k < dims; k++) {
+                if ((mask >> k & 1) && v / stride[k] % side == side - 1) {
+                    inside = false;
+                }
+            }
+            if (!inside) {
+                continue;
+            }
+            double value = 0;
+            for (uint32_t corner = mask;; corner = (corner - 1) & mask) {
+                uint64_t u = v;
+                for (uint32_t k = 0; k < dims; k++) {
+                    if (corner >> k & 1) {
+                        u += stride[k];
+                    }
+                }
+                value = std::max(value, image[u]);
+                if (corner == 0) {
+                    break;
+                }
+            }
+            cells.push_back({value, (uint32_t)__builtin_popcount(mask),
+                             v * masks + mask});
+        }
+    }
+
+    // Ids are unique across dimensions, so one table serves them all.
+    cells = truncate(std::move(cells), n);
+    std::vector<uint64_t> index(vertex_count * masks, not_included);
+    for (size_t i = 0; i < cells.size(); i++) {
+        index[cells[i].id] = i;
+    }
+
+    MatrixWriter writer(path, cells.size());
+    std::vector<uint64_t> rows;
+    for (const Cell& cell : cells) {
+        rows.clear();
+        uint64_t v = cell.id / masks;
+        uint32_t mask = cell.id % masks;
+        for (uint32_t k = 0; k < dims; k++) {
+            if (mask >> k & 1) {
+                uint32_t face_mask = mask ^ (1 << k);
+                rows.push_back(index[v * masks + face_mask]);
+                rows.push_back(index[(v + stride[k]) * masks + face_mask]);
+            }
+        }
+        writer.column(rows);
+    }
+    return writer.nnz();
+}
+
+// Cones over cycles of chain vertices: apex, cycle vertices, cycle edges,
+// spokes, then the triangles. Every triangle but the last has its own low;
+// the last one shares the low of its neighbour and has to absorb the whole
+// fan, one triangle per round, growing by one entry each time. That is
+// quadratic work and chain rounds for a linear-size input. Isolated
+// vertices pad the matrix to n columns.
+uint64_t generateFillIn(const std::string& path, uint64_t n, uint64_t chain) {
+    chain = std::max<uint64_t>(3, std::min(chain, (n - 1) / 4));
+    uint64_t copy_size = 4 * chain + 1;
+    uint64_t copies = std::max<uint64_t>(1, n / copy_size);
+
+    MatrixWriter writer(path, n);
+    std::vector<uint64_t> rows;
+    for (uint64_t c = 0; c < copies; c++) {
+        uint64_t apex = c * copy_size;
+        uint64_t vertex = apex + 1;
+        uint64_t edge = vertex + chain;
+        uint64_t spoke = edge + chain;
+        rows.clear();
+        for (uint64_t i = 0; i <= chain; i++) {
+            writer.column(rows);
+        }
+        for (uint64_t i = 0; i < chain; i++) {
+            rows = {vertex + i, vertex + (i + 1) % chain};
+            writer.column(rows);
+        }
+        for (uint64_t i = 0; i < chain; i++) {
+            rows = {apex, vertex + i};
+            writer.column(rows);
+        }
+        for (uint64_t i = 0; i < chain; i++) {
+            rows = {edge + i, spoke + i, spoke + (i + 1) % chain};
+            writer.column(rows);
+        }
+    }
+    rows.clear();
+    for (uint64_t i = copies * copy_size; i < n; i++) {
+        writer.column(rows);
+    }
+    return writer.nnz();
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program
+              << " [--n <columns>] [--dim <dimension>] [--seed <seed>] "
+                 "[--degree <average degree>] [--chain <length>] "
+                 "<rips-sphere/rips-torus/clique/cubical/fill-in> "
+                 "<output file name>\n";
+    std::cout << "--dim is the top simplex dimension, or the image "
+                 "dimension for cubical; fill-in is always 2-dimensional.\n";
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+    uint64_t n = 100000;
+    uint32_t dim = 2;
+    uint64_t seed = 1;
+    double degree = 8;
+    uint64_t chain = 1000;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--n" && i + 1 < argc) {
+            n = std::stoull(argv[++i]);
+        } else if (arg == "--dim" && i + 1 < argc) {
+            dim = std::stoul(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoull(argv[++i]);
+        } else if (arg == "--degree" && i + 1 < argc) {
+            degree = std::stod(argv[++i]);
+        } else if (arg == "--chain" && i + 1 < argc) {
+            chain = std::stoull(argv[++i]);
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cout << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 2 || n < 16) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string kind = positional[0];
+    std::string path = positional[1];
+    SplitMix64 random(seed);
+    uint64_t nnz;
+    if (kind == "rips-sphere" || kind == "rips-torus") {
+        nnz = generateRips(path, n, dim, random, kind == "rips-torus", degree);
+    } else if (kind == "clique") {
+        nnz = generateClique(path, n, dim, random, degree);
+    } else if (kind == "cubical") {
+        if (dim < 1 || dim > 4) {
+            std::cout << "cubical supports --dim 1 to 4\n";
+            return 1;
+        }
+        nnz = generateCubical(path, n, dim, random);
+    } else if (kind == "fill-in") {
+        nnz = generateFillIn(path, n, chain);
+    } else {
+        std::cout << "Unknown kind: " << kind << "\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::cerr << "wrote " << nnz << " nonzeros to " << path << "\n";
+    return 0;
+}
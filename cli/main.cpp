@@ -3,61 +3,447 @@
 #define MTL_PRIVATE_IMPLEMENTATION
 
 #include <Metal/Metal.hpp>
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sys/resource.h>
+#include <vector>
 
+#include <BatchScheduler.hpp>
+#include <ColumnProfile.hpp>
+#include <ExecutionBackend.hpp>
 #include <IMatrix.hpp>
+#include <MemoryResource.hpp>
 #include <MetalSparseMatrix.hpp>
 #include <ParallelSparseMatrix.hpp>
+#include <PerfCounters.hpp>
+#include <PersistencePairs.hpp>
 #include <SparseMatrix.hpp>
+#include <Telemetry.hpp>
+#include <Trace.hpp>
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program
+              << " [--threads <count>] [--backend <name>] [--phase-times] "
+                 "[--compact-rows] [--huge-pages] [--spill-dir <directory>] "
+                 "[--max-memory <bytes>[K/M/G][B]] [--telemetry <file>] "
+                 "[--trace <file>] [--perf-counters] [--stats <human/json>] "
+                 "[--profile <top-k>] "
+                 "<sparse/sparse-twist/sparse-parallel/sparse-parallel-twist/"
+                 "sparse-metal/sparse-metal-twist> "
+                 "<input file name> <output file name>\n";
+    std::cout << "       " << program
+              << " [--threads <count>] [--backend <name>] [--compact-rows] "
+                 "[--huge-pages] [--spill-dir <directory>] "
+                 "[--max-memory <bytes>[K/M/G][B]] [--trace <file>] "
+                 "<batch/batch-twist> "
+                 "<output directory> "
+                 "<input files or directories...>\n";
+    std::cout << "--telemetry writes per-round records as JSON lines, or as "
+                 "CSV if the file name ends in .csv; it needs a build with "
+                 "PH_TELEMETRY.\n";
+    std::cout << "--trace writes a Chrome trace of the thread pool at exit, "
+                 "for Perfetto.\n";
+    std::cout << "--perf-counters prints hardware counters per phase, "
+                 "through perf_event_open on Linux; misses per merged entry "
+                 "need a build with PH_TELEMETRY.\n";
+    std::cout << "--stats prints wall and CPU time per stage, peak RSS and "
+                 "the row index capacity to stderr.\n";
+    std::cout << "--profile prints the top-k columns by merge time, column "
+                 "length histograms and the fill-in per dimension to stderr; "
+                 "the metal engine does not support it.\n";
+    std::cout << "Backends:";
+    for (const auto& name : availableExecutionBackends()) {
+        std::cout << " " << name;
+    }
+    std::cout << "\n";
+}
+
+void printPhaseTimings(const ExecutionBackend& backend) {
+    for (const auto& [phase, timing] : backend.phaseTimings()) {
+        std::cerr << backend.name() << " " << phase << ": " << timing.seconds
+                  << " s in " << timing.calls << " calls\n";
+    }
+}
+
+// Sums the entries merged over every round and passes the rounds on to next,
+// if any.
+class MergedEntryCounter : public TelemetrySink {
+    public:
+        MergedEntryCounter(TelemetrySink* next) : next_(next) {}
+
+        void addRound(const RoundTelemetry& round) override {
+            entries_ += round.entries_merged;
+            if (next_) {
+                next_->addRound(round);
+            }
+        }
+
+        uint64_t entries() const { return entries_; }
+
+    private:
+        TelemetrySink* next_;
+        uint64_t entries_ = 0;
+};
+
+// entries is the number of entries merged, or 0 if unknown.
+void printPerfCounters(uint64_t entries) {
+    std::map<std::string, PerfCounts> counts = PerfCounters::phaseCounts();
+    for (const char* phase :
+         {"parse", "twist", "pivot", "widen", "add", "output"}) {
+        auto it = counts.find(phase);
+        if (it == counts.end()) {
+            continue;
+        }
+        const PerfCounts& c = it->second;
+        std::cerr << "perf " << phase << ": " << c.cycles << " cycles, "
+                  << c.instructions << " instructions, "
+                  << (c.cycles ? (double)c.instructions / c.cycles : 0)
+                  << " IPC, " << c.cache_misses << " cache misses, "
+                  << c.dtlb_misses << " dTLB misses, " << c.branch_misses
+                  << " branch misses\n";
+        if (std::string(phase) == "add" && entries > 0) {
+            std::cerr << "perf add per merged entry: "
+                      << (double)c.cache_misses / entries
+                      << " cache misses, "
+                      << (double)c.dtlb_misses / entries << " dTLB misses, "
+                      << (double)c.branch_misses / entries
+                      << " branch misses\n";
+        }
+    }
+}
+
+uint64_t peakRssBytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+// Wall and CPU time of each stage of a run, summed from the phases that
+// PerfCounters timed.
+void printStats(const std::string& format, const IMatrix& matrix) {
+    std::map<std::string, PerfCounts> counts = PerfCounters::phaseCounts();
+    const std::vector<std::pair<const char*, std::vector<const char*>>>
+        stages = {{"load", {"parse"}},
+                  {"twist", {"twist"}},
+                  {"reduce", {"pivot", "widen", "add"}},
+                  {"pairs", {"output"}},
+                  {"write", {"write"}}};
+    bool json = format == "json";
+    if (json) {
+        std::cerr << "{\"stages\": {";
+    }
+    for (size_t s = 0; s < stages.size(); s++) {
+        double wall = 0;
+        double cpu = 0;
+        for (const char* phase : stages[s].second) {
+            wall += counts[phase].wall_seconds;
+            cpu += counts[phase].cpu_seconds;
+        }
+        if (json) {
+            std::cerr << (s == 0 ? "" : ", ") << "\"" << stages[s].first
+                      << "\": {\"wall_seconds\": " << wall
+                      << ", \"cpu_seconds\": " << cpu << "}";
+        } else {
+            std::cerr << "stats " << stages[s].first << ": " << wall
+                      << " s wall, " << cpu << " s CPU\n";
+        }
+    }
+    if (json) {
+        std::cerr << "}, \"peak_rss_bytes\": " << peakRssBytes()
+                  << ", \"row_index_bytes\": " << matrix.rowIndexBytes()
+                  << "}\n";
+    } else {
+        std::cerr << "stats peak RSS: " << peakRssBytes() << " bytes\n";
+        std::cerr << "stats row index capacity: " << matrix.rowIndexBytes()
+                  << " bytes\n";
+    }
+}
+
+// Parses a decimal count. Unlike std::stoul, it rejects signs, spaces and
+// anything after the digits.
+size_t parseCount(const std::string& text) {
+    if (text.empty() || text.find_first_not_of("0123456789") !=
+                            std::string::npos) {
+        throw std::invalid_argument("Not a count: " + text);
+    }
+    try {
+        return std::stoull(text);
+    } catch (const std::out_of_range&) {
+        throw std::out_of_range("Count too large: " + text);
+    }
+}
+
+// Parses a count of bytes with an optional K, M or G suffix for powers of
+// 1024, which may be followed by B, or by iB, in either case.
+uint64_t parseByteSize(const std::string& text) {
+    size_t digits = text.find_first_not_of("0123456789");
+    if (digits == std::string::npos) {
+        digits = text.size();
+    }
+    std::string suffix;
+    for (char c : text.substr(digits)) {
+        suffix += std::toupper((unsigned char)c);
+    }
+    const std::map<std::string, int> shifts = {
+        {"", 0},   {"B", 0},   {"K", 10},   {"KB", 10},  {"KIB", 10},
+        {"M", 20}, {"MB", 20}, {"MIB", 20}, {"G", 30},   {"GB", 30},
+        {"GIB", 30}};
+    auto shift = shifts.find(suffix);
+    if (digits == 0 || shift == shifts.end()) {
+        throw std::invalid_argument("Not a byte size: " + text);
+    }
+
+    uint64_t value = 0;
+    bool too_large = false;
+    try {
+        value = parseCount(text.substr(0, digits));
+    } catch (const std::out_of_range&) {
+        too_large = true;
+    }
+    if (too_large ||
+        value > std::numeric_limits<uint64_t>::max() >> shift->second) {
+        throw std::out_of_range("Byte size too large: " + text);
+    }
+    return value << shift->second;
+}
+
+int runBatch(const std::string& mode, const std::vector<std::string>& args,
+             const BatchOptions& options) {
+    std::vector<std::string> inputs(args.begin() + 1, args.end());
+    std::vector<BatchJob> jobs = collectBatchJobs(inputs, args[0]);
+
+    BatchOptions batch_options = options;
+    batch_options.run_twist = mode == "batch-twist";
+    BatchReport report = BatchScheduler(batch_options).run(jobs);
+    std::cout << report.completed << " matrices in " << report.seconds
+              << " s, " << report.matricesPerSecond() << " matrices/s, "
+              << report.peak_memory << " bytes peak memory";
+    if (report.failed > 0) {
+        std::cout << ", " << report.failed << " failed";
+    }
+    std::cout << "\n";
+    return report.failed > 0 ? 1 : 0;
+}
 
 int main(int argc, const char* argv[]) {
-    if (argc != 4) {
-        std::cout << "Usage: " << argv[0]
-                  << " <sparse/sparse-twist/sparse-parallel/"
-                     "sparse-parallel-twist/sparse-metal/sparse-metal-twist> "
-                     "<input file name> <output file name>\n";
+    size_t num_threads = 0;
+    std::string backend_name = "threadpool";
+    bool phase_times = false;
+    uint64_t max_memory = 0;
+    bool huge_pages = false;
+    std::string telemetry_path;
+    bool perf_counters = false;
+    std::string stats_format;
+    bool profile_columns = false;
+    size_t profile_top_k = 0;
+    ArenaOptions arena;
+    std::vector<std::string> positional;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--threads" && i + 1 < argc) {
+                num_threads = parseCount(argv[++i]);
+            } else if (arg == "--backend" && i + 1 < argc) {
+                backend_name = argv[++i];
+            } else if (arg == "--phase-times") {
+                phase_times = true;
+            } else if (arg == "--compact-rows") {
+                arena.encoding = RowEncoding::Compact;
+            } else if (arg == "--huge-pages") {
+                huge_pages = true;
+            } else if (arg == "--spill-dir" && i + 1 < argc) {
+                arena.spill_memory =
+                    std::make_shared<MappedFileResource>(argv[++i]);
+            } else if (arg == "--max-memory" && i + 1 < argc) {
+                max_memory = parseByteSize(argv[++i]);
+            } else if (arg == "--telemetry" && i + 1 < argc) {
+                telemetry_path = argv[++i];
+            } else if (arg == "--trace" && i + 1 < argc) {
+                Trace::enable(argv[++i]);
+            } else if (arg == "--perf-counters") {
+                perf_counters = true;
+            } else if (arg == "--stats" && i + 1 < argc) {
+                stats_format = argv[++i];
+                if (stats_format != "human" && stats_format != "json") {
+                    std::cout << "Unknown stats format: " << stats_format
+                              << "\n";
+                    printUsage(argv[0]);
+                    return 1;
+                }
+            } else if (arg == "--profile" && i + 1 < argc) {
+                profile_columns = true;
+                profile_top_k = parseCount(argv[++i]);
+            } else if (arg.rfind("--", 0) == 0) {
+                std::cout << "Unknown option: " << arg << "\n";
+                printUsage(argv[0]);
+                return 1;
+            } else {
+                positional.push_back(arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << e.what() << "\n";
+        printUsage(argv[0]);
         return 1;
     }
 
-    std::string mode = argv[1];
-    std::string inputFileName = argv[2];
-    std::string outputFileName = argv[3];
+    if (!positional.empty() &&
+        (positional[0] == "batch" || positional[0] == "batch-twist")) {
+        BatchOptions options;
+        options.memory_budget = max_memory;
+        options.thread_budget = num_threads;
+        options.backend_name = backend_name;
+        options.arena = arena;
+        options.huge_pages = huge_pages;
+        std::vector<std::string> args(positional.begin() + 1,
+                                      positional.end());
+        if (args.size() < 2) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        return runBatch(positional[0], args, options);
+    }
 
-    std::unique_ptr<IMatrix> matrix;
-    if (mode == "sparse" || mode == "sparse-twist") {
-        matrix = std::make_unique<SparseMatrix>(inputFileName);
-    } else if (mode == "sparse-parallel" || mode == "sparse-parallel-twist") {
-        matrix = std::make_unique<ParallelSparseMatrix>(inputFileName);
-    } else if (mode == "sparse-metal" || mode == "sparse-metal-twist") {
-        matrix = std::make_unique<MetalSparseMatrix>(inputFileName);
-    } else {
-        std::cout << "Unknown mode: " << mode << "\n";
+    if (positional.size() != 3) {
+        printUsage(argv[0]);
         return 1;
     }
 
-    auto start = std::chrono::high_resolution_clock::now();
-    std::vector<uint32_t> result = matrix->reduce(
-        mode == "sparse-twist" || mode == "sparse-parallel-twist" ||
-        mode == "sparse-metal-twist");
-    std::cout << std::chrono::duration_cast<std::chrono::microseconds>(
-                     std::chrono::high_resolution_clock::now() - start)
-                         .count() /
-                     1'000'000.0
-              << "\n";
+    std::string mode = positional[0];
+    std::string inputFileName = positional[1];
+    std::string outputFileName = positional[2];
 
-    std::vector<std::pair<uint32_t, uint32_t>> result_pairs;
-    for (size_t i = 0; i < result.size(); i++) {
-        if (result[i] != matrix->size()) {
-            result_pairs.emplace_back(result[i], i);
+    if (max_memory != 0 || huge_pages) {
+        std::shared_ptr<MemoryResource> upstream;
+        if (huge_pages) {
+            upstream = std::make_shared<HugePageResource>();
         }
+        arena.memory = std::make_shared<MemoryBudget>(max_memory, upstream);
+    }
+
+    if (!stats_format.empty()) {
+        PerfCounters::enable();
+    }
+    if (perf_counters && !PerfCounters::enableHardware()) {
+        std::cerr << "Could not open hardware counters\n";
+        perf_counters = false;
+    }
+
+    bool metal = mode == "sparse-metal" || mode == "sparse-metal-twist";
+    if (mode != "sparse" && mode != "sparse-twist" &&
+        mode != "sparse-parallel" && mode != "sparse-parallel-twist" &&
+        !metal) {
+        std::cout << "Unknown mode: " << mode << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<TelemetryWriter> telemetry;
+    if (!telemetry_path.empty()) {
+#ifndef PH_TELEMETRY
+        std::cerr << "Built without PH_TELEMETRY, no telemetry is recorded\n";
+#endif
+        bool csv = telemetry_path.size() >= 4 &&
+                   telemetry_path.compare(telemetry_path.size() - 4, 4,
+                                          ".csv") == 0;
+        telemetry = std::make_unique<TelemetryWriter>(
+            telemetry_path, csv ? TelemetryWriter::Format::Csv
+                                : TelemetryWriter::Format::JsonLines);
     }
-    std::sort(result_pairs.begin(), result_pairs.end());
+    MergedEntryCounter merged_entries(telemetry.get());
+    ColumnProfile profile;
+    if (profile_columns && metal) {
+        std::cerr << "The metal engine does not record a column profile\n";
+        profile_columns = false;
+    }
+
+    // Loading and reducing both allocate from the memory budget. If either
+    // fails, no partial output is left behind.
+    std::shared_ptr<ExecutionBackend> backend;
+    std::unique_ptr<IMatrix> matrix;
+    std::optional<PairFileWriter> pairs;
+    IoUsage io_before = processIoUsage();
+    try {
+        if (mode == "sparse" || mode == "sparse-twist") {
+            matrix = makeMatrix<SparseMatrix>(inputFileName, arena);
+        } else if (metal) {
+            backend = makeExecutionBackend(backend_name, num_threads);
+            matrix =
+                std::make_unique<MetalSparseMatrix>(inputFileName, backend);
+        } else {
+            backend = makeExecutionBackend(backend_name, num_threads);
+            matrix = makeMatrix<ParallelSparseMatrix>(inputFileName, backend,
+                                                      arena);
+        }
+        matrix->setTelemetry(telemetry.get());
+#ifdef PH_TELEMETRY
+        if (perf_counters) {
+            matrix->setTelemetry(&merged_entries);
+        }
+#endif
+        if (profile_columns) {
+            matrix->setProfile(&profile);
+        }
 
-    std::ofstream outputFile(outputFileName);
-    for (const auto& [birth, death] : result_pairs) {
-        outputFile << birth << " " << death << "\n";
+        pairs.emplace(outputFileName);
+        auto start = std::chrono::high_resolution_clock::now();
+        matrix->reduce(*pairs, mode == "sparse-twist" ||
+                                   mode == "sparse-parallel-twist" ||
+                                   mode == "sparse-metal-twist");
+        double reduce_seconds =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - start)
+                .count() /
+            1'000'000.0;
+        // Pairs stream to the file during the reduction; the time printed
+        // leaves out writing them, as when they were written afterwards.
+        std::cout << reduce_seconds - pairs->writeSeconds() << "\n";
+        pairs->flush();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        if (pairs) {
+            pairs.reset();
+            std::error_code error;
+            std::filesystem::remove(outputFileName, error);
+        }
+        return 1;
+    }
+    if (phase_times) {
+        std::cerr << "write: " << pairs->writeSeconds() << " s\n";
+    }
+    if (phase_times && backend) {
+        printPhaseTimings(*backend);
+    }
+    if (perf_counters) {
+        printPerfCounters(merged_entries.entries());
+    }
+    if (!stats_format.empty()) {
+        printStats(stats_format, *matrix);
+    }
+    if (profile_columns) {
+        profile.report(std::cerr, profile_top_k);
+    }
+    if (arena.memory) {
+        std::cerr << "memory: " << arena.memory->peak() << " bytes peak, "
+                  << arena.memory->current() << " bytes in use\n";
+    }
+    if (arena.spill_memory) {
+        IoUsage io_after = processIoUsage();
+        std::cerr << "spill: " << io_after.bytes_read - io_before.bytes_read
+                  << " bytes read, "
+                  << io_after.bytes_written - io_before.bytes_written
+                  << " bytes written\n";
     }
     return 0;
 }
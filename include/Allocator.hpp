@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "MemoryResource.hpp"
+
+// Allocator that default-initialises instead of value-initialising, so
+// resizing a vector of integers leaves the new pages untouched until a worker
+// first writes them. That first write decides which NUMA node backs the page.
+// Memory comes from resource, or from the heap if it is null; the resource
+// travels with the vector when it is moved or swapped.
+template <typename T>
+class DefaultInitAllocator {
+    public:
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::true_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        DefaultInitAllocator(MemoryResource* resource = nullptr) noexcept
+            : resource_(resource) {}
+
+        template <typename U>
+        DefaultInitAllocator(const DefaultInitAllocator<U>& other) noexcept
+            : resource_(other.resource()) {}
+
+        T* allocate(size_t count) {
+            if (resource_ == nullptr) {
+                return std::allocator<T>().allocate(count);
+            }
+            return static_cast<T*>(resource_->allocate(count * sizeof(T)));
+        }
+
+        void deallocate(T* ptr, size_t count) {
+            if (resource_ == nullptr) {
+                std::allocator<T>().deallocate(ptr, count);
+            } else {
+                resource_->deallocate(ptr, count * sizeof(T));
+            }
+        }
+
+        template <typename U>
+        void construct(U* ptr) {
+            ::new (static_cast<void*>(ptr)) U;
+        }
+
+        template <typename U, typename... Args>
+        void construct(U* ptr, Args&&... args) {
+            ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+        }
+
+        MemoryResource* resource() const { return resource_; }
+
+    private:
+        MemoryResource* resource_;
+};
+
+template <typename T, typename U>
+bool operator==(const DefaultInitAllocator<T>& a,
+                const DefaultInitAllocator<U>& b) {
+    return a.resource() == b.resource();
+}
+
+template <typename T, typename U>
+bool operator!=(const DefaultInitAllocator<T>& a,
+                const DefaultInitAllocator<U>& b) {
+    return !(a == b);
+}
+
+template <typename T>
+using DefaultInitVector = std::vector<T, DefaultInitAllocator<T>>;
+
+using IndexVector = DefaultInitVector<uint32_t>;
@@ -0,0 +1,216 @@
+#include "BatchScheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unistd.h>
+
+#include "ParallelSparseMatrix.hpp"
+#include "PersistencePairs.hpp"
+#include "SparseMatrix.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+double BatchReport::matricesPerSecond() const {
+    return seconds > 0 ? completed / seconds : 0;
+}
+
+BatchScheduler::BatchScheduler(const BatchOptions& options)
+    : options_(options) {
+    if (options_.thread_budget == 0) {
+        options_.thread_budget = ThreadPool::defaultThreadCount();
+    }
+    if (options_.memory_budget == 0) {
+        uint64_t physical =
+            (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+        options_.memory_budget = physical / 10 * 8;
+    }
+    if (!options_.arena.memory) {
+        std::shared_ptr<MemoryResource> upstream;
+        if (options_.huge_pages) {
+            upstream = std::make_shared<HugePageResource>();
+        }
+        options_.arena.memory =
+            std::make_shared<MemoryBudget>(options_.memory_budget, upstream);
+    }
+}
+
+uint64_t BatchScheduler::estimateMemory(uint64_t n, uint64_t nnz) const {
+    // The index types makeMatrix will load the job with.
+    IndexWidths widths = chooseIndexWidths(n, nnz);
+    uint64_t offset_bytes =
+        widths.wide_offsets ? sizeof(uint64_t) : sizeof(uint32_t);
+    uint64_t row_bytes = widths.wide_rows ? sizeof(uint64_t) : sizeof(uint32_t);
+
+    uint64_t row_index_bytes =
+        2 * row_bytes * (uint64_t)(nnz * options_.widen_growth);
+    if (options_.arena.spill_memory) {
+        row_index_bytes = 0;
+    }
+    // Start, end and capacity offsets, the window base and to_add of each
+    // column, and its pivot owner.
+    uint64_t column_bytes =
+        n * (3 * offset_bytes + 2 * row_bytes + sizeof(uint64_t));
+    return row_index_bytes + column_bytes;
+}
+
+bool BatchScheduler::runJob(const PlannedJob& planned) {
+    TraceScope span("job");
+    try {
+        std::unique_ptr<IMatrix> matrix;
+        if (planned.parallel) {
+            matrix = makeMatrix<ParallelSparseMatrix>(
+                planned.job->input_path, backend_, options_.arena);
+        } else {
+            matrix = makeMatrix<SparseMatrix>(planned.job->input_path,
+                                              options_.arena);
+        }
+        std::optional<PairFileWriter> pairs;
+        try {
+            pairs.emplace(planned.job->output_path);
+            matrix->reduce(*pairs, options_.run_twist);
+        } catch (...) {
+            // Leaves no partial output behind.
+            if (pairs) {
+                pairs.reset();
+                std::error_code error;
+                std::filesystem::remove(planned.job->output_path, error);
+            }
+            throw;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << planned.job->input_path << ": " << e.what() << "\n";
+        return false;
+    }
+}
+
+BatchReport BatchScheduler::run(const std::vector<BatchJob>& jobs) {
+    auto start = std::chrono::steady_clock::now();
+    BatchReport report;
+
+    std::vector<PlannedJob> plan;
+    for (const BatchJob& job : jobs) {
+        try {
+            uint64_t n = 0;
+            uint64_t nnz = estimateNnz(job.input_path, n);
+            plan.push_back({&job, estimateMemory(n, nnz),
+                            nnz >= options_.parallel_min_nnz &&
+                                options_.thread_budget > 1});
+        } catch (const std::exception& e) {
+            std::cerr << job.input_path << ": " << e.what() << "\n";
+            report.failed++;
+        }
+    }
+    std::stable_sort(plan.begin(), plan.end(),
+                     [](const PlannedJob& a, const PlannedJob& b) {
+                         return a.memory > b.memory;
+                     });
+
+    bool any_parallel = std::any_of(plan.begin(), plan.end(),
+                                    [](const PlannedJob& planned) {
+                                        return planned.parallel;
+                                    });
+    if (any_parallel && !backend_) {
+        backend_ = makeExecutionBackend(options_.backend_name,
+                                        options_.thread_budget - 1);
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t next = 0;
+    uint64_t used_memory = 0;
+    size_t used_threads = 0;
+    auto threadsFor = [&](const PlannedJob& planned) {
+        return planned.parallel ? options_.thread_budget : 1;
+    };
+    auto admissible = [&] {
+        if (next == plan.size()) {
+            return true;
+        }
+        const PlannedJob& planned = plan[next];
+        bool memory_fits =
+            used_memory == 0 ||
+            used_memory + planned.memory <= options_.memory_budget;
+        return memory_fits &&
+               used_threads + threadsFor(planned) <= options_.thread_budget;
+    };
+
+    auto runner = [&] {
+        while (true) {
+            PlannedJob planned;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, admissible);
+                if (next == plan.size()) {
+                    return;
+                }
+                planned = plan[next++];
+                used_memory += planned.memory;
+                used_threads += threadsFor(planned);
+            }
+
+            bool ok = runJob(planned);
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                used_memory -= planned.memory;
+                used_threads -= threadsFor(planned);
+                if (ok) {
+                    report.completed++;
+                } else {
+                    report.failed++;
+                }
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> runners;
+    for (size_t i = 0; i < options_.thread_budget; i++) {
+        runners.emplace_back(runner);
+    }
+    for (auto& thread : runners) {
+        thread.join();
+    }
+
+    report.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    report.peak_memory = options_.arena.memory->peak();
+    return report;
+}
+
+std::vector<BatchJob> collectBatchJobs(const std::vector<std::string>& inputs,
+                                       const std::string& output_dir) {
+    std::vector<std::filesystem::path> files;
+    for (const auto& input : inputs) {
+        if (std::filesystem::is_directory(input)) {
+            std::vector<std::filesystem::path> entries;
+            for (const auto& entry :
+                 std::filesystem::directory_iterator(input)) {
+                if (entry.is_regular_file()) {
+                    entries.push_back(entry.path());
+                }
+            }
+            std::sort(entries.begin(), entries.end());
+            files.insert(files.end(), entries.begin(), entries.end());
+        } else {
+            files.emplace_back(input);
+        }
+    }
+
+    std::vector<BatchJob> jobs;
+    for (const auto& file : files) {
+        jobs.push_back({file.string(),
+                        (std::filesystem::path(output_dir) /
+                         (file.filename().string() + ".pairs"))
+                            .string()});
+    }
+    return jobs;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ColumnArena.hpp"
+#include "ExecutionBackend.hpp"
+
+struct BatchJob {
+        std::string input_path;
+        std::string output_path;
+};
+
+struct BatchOptions {
+        // 0 means 80% of physical memory.
+        uint64_t memory_budget = 0;
+        // 0 means ThreadPool::defaultThreadCount().
+        size_t thread_budget = 0;
+        // Matrices with at least this many estimated nonzeros are reduced by
+        // ParallelSparseMatrix using the whole thread budget; smaller ones run
+        // on SparseMatrix, one thread each, side by side.
+        uint64_t parallel_min_nnz = 1 << 20;
+        // Expected growth of row_index_ through widening, over the input nnz.
+        double widen_growth = 3;
+        bool run_twist = true;
+        std::string backend_name = "threadpool";
+        // Index arrays on huge pages; see HugePageResource.
+        bool huge_pages = false;
+        // Shared by every job. Without arena.memory, a budget capped at
+        // memory_budget is made. With arena.spill_memory, row index arrays
+        // are left out of admission, as they can spill.
+        ArenaOptions arena;
+};
+
+struct BatchReport {
+        size_t completed = 0;
+        size_t failed = 0;
+        double seconds = 0;
+        // Of the index arrays of all jobs together.
+        uint64_t peak_memory = 0;
+
+        double matricesPerSecond() const;
+};
+
+// Runs many reductions in one process. Jobs are admitted largest first, as
+// long as their estimated memory fits the remaining memory budget and their
+// threads fit the thread budget; a job larger than the whole budget runs
+// alone. The budget is also a hard cap on what the jobs allocate, under
+// which an engine compacts or spills, or else fails its job.
+class BatchScheduler {
+    public:
+        BatchScheduler(const BatchOptions& options);
+
+        BatchReport run(const std::vector<BatchJob>& jobs);
+
+        uint64_t estimateMemory(uint64_t n, uint64_t nnz) const;
+
+    private:
+        struct PlannedJob {
+                const BatchJob* job;
+                uint64_t memory;
+                bool parallel;
+        };
+
+        bool runJob(const PlannedJob& planned);
+
+        BatchOptions options_;
+        std::shared_ptr<ExecutionBackend> backend_;
+};
+
+// Expands directories into the regular files they contain, sorted by name,
+// and names every output "<output directory>/<input file name>.pairs".
+std::vector<BatchJob> collectBatchJobs(const std::vector<std::string>& inputs,
+                                       const std::string& output_dir);
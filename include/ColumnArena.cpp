@@ -0,0 +1,628 @@
+#include "ColumnArena.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "Relayout.hpp"
+
+namespace {
+
+uint32_t ceilClass(size_t entries) {
+    uint32_t size_class = 0;
+    while (((size_t)1 << size_class) < entries) {
+        size_class++;
+    }
+    return size_class;
+}
+
+uint32_t floorClass(size_t entries) {
+    uint32_t size_class = 0;
+    while (((size_t)2 << size_class) <= entries) {
+        size_class++;
+    }
+    return size_class;
+}
+
+const uint32_t window_bits = 16;
+
+// Iterates over the 16-bit entries of a compact column. A uint16_t pointer
+// may not alias the Row words that hold them, so entries are read through
+// memcpy, which compiles to a plain load.
+class CompactEntries {
+    public:
+        explicit CompactEntries(const unsigned char* bytes) : bytes_(bytes) {}
+
+        uint16_t operator*() const {
+            uint16_t entry;
+            std::memcpy(&entry, bytes_, sizeof(entry));
+            return entry;
+        }
+
+        CompactEntries& operator++() {
+            bytes_ += sizeof(uint16_t);
+            return *this;
+        }
+
+        CompactEntries operator++(int) {
+            CompactEntries old = *this;
+            ++*this;
+            return old;
+        }
+
+        CompactEntries operator+(size_t k) const {
+            return CompactEntries(bytes_ + k * sizeof(uint16_t));
+        }
+
+        bool operator<(const CompactEntries& other) const {
+            return bytes_ < other.bytes_;
+        }
+
+    private:
+        const unsigned char* bytes_;
+};
+
+void storeEntry(unsigned char* bytes, size_t k, uint16_t entry) {
+    std::memcpy(bytes + k * sizeof(entry), &entry, sizeof(entry));
+}
+
+// Merges two sorted columns, given as pointers or CompactEntries, modulo 2.
+// Rows are read as base + entry and written as row - out_base; with every
+// base 0 this is a plain merge of the stored entries.
+template <typename Row, typename A, typename B, typename Out>
+size_t mergeRows(A a, size_t len_a, Row base_a, B b, size_t len_b,
+                 Row base_b, Out* out, Row out_base) {
+    A end_a = a + len_a;
+    B end_b = b + len_b;
+    size_t k = 0;
+    while (a < end_a && b < end_b) {
+        Row row_a = base_a + *a;
+        Row row_b = base_b + *b;
+        if (row_a < row_b) {
+            out[k++] = row_a - out_base;
+            a++;
+        } else if (row_a > row_b) {
+            out[k++] = row_b - out_base;
+            b++;
+        } else {
+            a++;
+            b++;
+        }
+    }
+    while (a < end_a) {
+        out[k++] = base_a + *a++ - out_base;
+    }
+    while (b < end_b) {
+        out[k++] = base_b + *b++ - out_base;
+    }
+    return k;
+}
+
+#ifdef PH_TELEMETRY
+template <typename Stats>
+void countAddition(Stats& stats, size_t entries, size_t result) {
+    stats.additions++;
+    stats.entries_merged += entries;
+    stats.entries_cancelled += entries - result;
+}
+#endif
+
+}  // namespace
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::WorkspaceReturn::operator()(
+    Workspace* workspace) const {
+    std::unique_lock<std::mutex> lock(arena->workspaces_mutex_);
+    arena->idle_workspaces_.push_back(workspace);
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::assign(RowVector row_index,
+                                      OffsetVector col_start,
+                                      OffsetVector col_end,
+                                      RowEncoding encoding) {
+    row_index_ = std::move(row_index);
+    col_start_ = std::move(col_start);
+    col_end_ = std::move(col_end);
+    encoding_ = encoding;
+
+    size_t n = col_start_.size();
+    col_capacity_ = OffsetVector(n, col_start_.get_allocator());
+    col_base_ = RowVector(n, col_start_.get_allocator());
+    for (size_t i = 0; i < n; i++) {
+        size_t next_start = i + 1 < n ? col_start_[i + 1] : row_index_.size();
+        col_capacity_[i] = next_start - col_start_[i];
+
+        // Narrowing in place is safe: entry k is written over bytes that
+        // entry k has already been read from.
+        size_t start = col_start_[i];
+        size_t len = col_end_[i] - start;
+        col_base_[i] = wide_column;
+        if (encoding_ == RowEncoding::Compact &&
+            (len == 0 || fitsWindow(row_index_[start],
+                                    row_index_[start + len - 1]))) {
+            Row base = len == 0 ? 0 : windowBase(row_index_[start]);
+            unsigned char* bytes = compactBytes(i);
+            for (size_t k = 0; k < len; k++) {
+                storeEntry(bytes, k, row_index_[start + k] - base);
+            }
+            setCompactLength(i, base, len);
+        }
+    }
+    used_ = row_index_.size();
+}
+
+template <typename Offset, typename Row>
+bool ColumnArena<Offset, Row>::fitsWindow(Row min_row, Row max_row) {
+    return min_row >> window_bits == max_row >> window_bits;
+}
+
+template <typename Offset, typename Row>
+Row ColumnArena<Offset, Row>::windowBase(Row row) {
+    return row >> window_bits << window_bits;
+}
+
+template <typename Offset, typename Row>
+bool ColumnArena<Offset, Row>::isCompact(size_t col) const {
+    return col_base_[col] != wide_column;
+}
+
+template <typename Offset, typename Row>
+Row ColumnArena<Offset, Row>::base(size_t col) const {
+    return windowBase(col_base_[col]);
+}
+
+template <typename Offset, typename Row>
+const unsigned char* ColumnArena<Offset, Row>::compactBytes(
+    size_t col) const {
+    return reinterpret_cast<const unsigned char*>(row_index_.data() +
+                                                  col_start_[col]);
+}
+
+template <typename Offset, typename Row>
+unsigned char* ColumnArena<Offset, Row>::compactBytes(size_t col) {
+    return reinterpret_cast<unsigned char*>(row_index_.data() +
+                                            col_start_[col]);
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::setCompactLength(size_t col, Row base,
+                                                size_t len) {
+    size_t words = (len + entries_per_word - 1) / entries_per_word;
+    col_base_[col] = base | (Row)(words * entries_per_word - len);
+    col_end_[col] = col_start_[col] + words;
+}
+
+template <typename Offset, typename Row>
+size_t ColumnArena<Offset, Row>::columnCount() const {
+    return col_start_.size();
+}
+
+template <typename Offset, typename Row>
+size_t ColumnArena<Offset, Row>::length(size_t col) const {
+    size_t words = col_end_[col] - col_start_[col];
+    if (!isCompact(col)) {
+        return words;
+    }
+    return words * entries_per_word - (col_base_[col] - base(col));
+}
+
+template <typename Offset, typename Row>
+size_t ColumnArena<Offset, Row>::capacity(size_t col) const {
+    return col_capacity_[col];
+}
+
+template <typename Offset, typename Row>
+Row ColumnArena<Offset, Row>::low(size_t col) const {
+    if (col_start_[col] == col_end_[col]) {
+        return col_start_.size();
+    }
+    if (!isCompact(col)) {
+        return row_index_[col_end_[col] - 1];
+    }
+    CompactEntries entries(compactBytes(col));
+    return base(col) + *(entries + (length(col) - 1));
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::clear(size_t col) {
+    col_end_[col] = col_start_[col];
+    if (isCompact(col)) {
+        col_base_[col] = base(col);
+    }
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::discard(size_t col, Workspace& workspace) {
+    clear(col);
+    release(col_start_[col], col_capacity_[col], workspace);
+    col_capacity_[col] = 0;
+}
+
+template <typename Offset, typename Row>
+size_t ColumnArena<Offset, Row>::blockSize(size_t entries) {
+    return (size_t)1 << ceilClass(entries);
+}
+
+template <typename Offset, typename Row>
+bool ColumnArena<Offset, Row>::allocate(size_t words, Workspace& workspace,
+                                        Offset& offset, Offset& capacity) {
+    uint32_t size_class = ceilClass(words);
+    capacity = (Offset)1 << size_class;
+
+    std::vector<Offset>& free_blocks = workspace.free_blocks[size_class];
+    if (!free_blocks.empty()) {
+        offset = free_blocks.back();
+        free_blocks.pop_back();
+        return true;
+    }
+
+    size_t used = used_.load(std::memory_order_relaxed);
+    while (used + capacity <= row_index_.size()) {
+        if (used_.compare_exchange_weak(used, used + capacity,
+                                        std::memory_order_relaxed)) {
+            offset = used;
+            return true;
+        }
+    }
+
+    // The front of the smallest larger free block; the rest of it stays free
+    // as one block of each class from size_class up.
+    for (uint32_t larger = size_class + 1; larger < 8 * sizeof(Offset);
+         larger++) {
+        std::vector<Offset>& larger_blocks = workspace.free_blocks[larger];
+        if (larger_blocks.empty()) {
+            continue;
+        }
+        offset = larger_blocks.back();
+        larger_blocks.pop_back();
+        for (uint32_t split = size_class; split < larger; split++) {
+            workspace.free_blocks[split].push_back(offset +
+                                                   ((Offset)1 << split));
+        }
+        return true;
+    }
+    return false;
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::release(Offset offset, Offset capacity,
+                                       Workspace& workspace) {
+    if (capacity > 0) {
+        workspace.free_blocks[floorClass(capacity)].push_back(offset);
+    }
+}
+
+template <typename Offset, typename Row>
+bool ColumnArena<Offset, Row>::makeRoom(size_t col, size_t words,
+                                        Workspace& workspace) {
+    if (words <= col_capacity_[col]) {
+        return true;
+    }
+
+    Offset offset;
+    Offset capacity;
+    if (!allocate(words, workspace, offset, capacity)) {
+        return false;
+    }
+    PH_TELEMETRY_ONLY(workspace.stats.widen_events++;)
+    release(col_start_[col], col_capacity_[col], workspace);
+    col_start_[col] = offset;
+    col_end_[col] = offset;
+    col_capacity_[col] = capacity;
+    return true;
+}
+
+template <typename Offset, typename Row>
+bool ColumnArena<Offset, Row>::addColumn(size_t add_to, size_t add_from,
+                                         Workspace& workspace) {
+    size_t len_to = length(add_to);
+    size_t len_from = length(add_from);
+    size_t max_len = len_to + len_from;
+
+    // Both columns in the same window: merge the 16-bit entries directly.
+    if (isCompact(add_to) && isCompact(add_from) &&
+        base(add_to) == base(add_from)) {
+        std::vector<uint16_t>& scratch = workspace.compact_scratch;
+        scratch.resize(std::max(scratch.size(), max_len));
+        size_t k = mergeRows<Row>(CompactEntries(compactBytes(add_to)),
+                                  len_to, 0,
+                                  CompactEntries(compactBytes(add_from)),
+                                  len_from, 0, scratch.data(), 0);
+
+        Row col_base = base(add_to);
+        size_t words = (k + entries_per_word - 1) / entries_per_word;
+        if (!makeRoom(add_to, words, workspace)) {
+            return false;
+        }
+        std::memcpy(compactBytes(add_to), scratch.data(),
+                    k * sizeof(uint16_t));
+        setCompactLength(add_to, col_base, k);
+        PH_TELEMETRY_ONLY(countAddition(workspace.stats, max_len, k);)
+        return true;
+    }
+
+    RowVector& scratch = workspace.scratch;
+    scratch.resize(std::max(scratch.size(), max_len));
+    const Row* wide_to = row_index_.data() + col_start_[add_to];
+    const Row* wide_from = row_index_.data() + col_start_[add_from];
+    size_t k;
+    CompactEntries compact_to(compactBytes(add_to));
+    CompactEntries compact_from(compactBytes(add_from));
+    if (isCompact(add_to) && isCompact(add_from)) {
+        k = mergeRows<Row>(compact_to, len_to, base(add_to), compact_from,
+                           len_from, base(add_from), scratch.data(), 0);
+    } else if (isCompact(add_to)) {
+        k = mergeRows<Row>(compact_to, len_to, base(add_to), wide_from,
+                           len_from, 0, scratch.data(), 0);
+    } else if (isCompact(add_from)) {
+        k = mergeRows<Row>(wide_to, len_to, 0, compact_from, len_from,
+                           base(add_from), scratch.data(), 0);
+    } else {
+        k = mergeRows<Row>(wide_to, len_to, 0, wide_from, len_from, 0,
+                           scratch.data(), 0);
+    }
+
+    bool compact = encoding_ == RowEncoding::Compact &&
+                   (k == 0 || fitsWindow(scratch[0], scratch[k - 1]));
+    size_t words =
+        compact ? (k + entries_per_word - 1) / entries_per_word : k;
+    if (!makeRoom(add_to, words, workspace)) {
+        return false;
+    }
+    if (compact) {
+        Row col_base = k == 0 ? 0 : windowBase(scratch[0]);
+        unsigned char* bytes = compactBytes(add_to);
+        for (size_t e = 0; e < k; e++) {
+            storeEntry(bytes, e, scratch[e] - col_base);
+        }
+        setCompactLength(add_to, col_base, k);
+    } else {
+        std::copy(scratch.begin(), scratch.begin() + k,
+                  row_index_.begin() + col_start_[add_to]);
+        col_end_[add_to] = col_start_[add_to] + k;
+        col_base_[add_to] = wide_column;
+    }
+    PH_TELEMETRY_ONLY(countAddition(workspace.stats, max_len, k);)
+    return true;
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::gatherFreeBlocks(Workspace& workspace) {
+    std::vector<std::pair<size_t, size_t>> blocks;
+    for (auto& other : workspaces_) {
+        for (size_t c = 0; c < 8 * sizeof(Offset); c++) {
+            for (Offset offset : other->free_blocks[c]) {
+                blocks.emplace_back(offset, (size_t)1 << c);
+            }
+            other->free_blocks[c].clear();
+        }
+    }
+    std::sort(blocks.begin(), blocks.end());
+
+    // Adjacent free blocks are joined and the run is cut again into the
+    // largest blocks that fit, so that freed neighbours make room for a
+    // larger class.
+    for (size_t b = 0; b < blocks.size();) {
+        size_t start = blocks[b].first;
+        size_t end = start + blocks[b].second;
+        for (b++; b < blocks.size() && blocks[b].first == end; b++) {
+            end += blocks[b].second;
+        }
+        while (start < end) {
+            uint32_t size_class = floorClass(end - start);
+            workspace.free_blocks[size_class].push_back(start);
+            start += (size_t)1 << size_class;
+        }
+    }
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::reserve(size_t words) {
+    size_t used = used_.load();
+    if (used + words <= row_index_.size()) {
+        return;
+    }
+
+    size_t max_size = std::numeric_limits<Offset>::max();
+    if (used + words > max_size) {
+        throw std::runtime_error("Column arena exceeds its offset type");
+    }
+    size_t needed = used + words;
+    size_t grown = std::max(needed, row_index_.size() * 3 / 2);
+    size_t slack = std::min(max_size, grown) - needed;
+    // Under a memory budget the slack is halved until the array fits, as
+    // growing by nothing would mean growing again on the next add.
+    while (true) {
+        try {
+            reallocateRows(needed + slack, rowMemory());
+            return;
+        } catch (const MemoryBudgetExceeded&) {
+            if (slack == 0) {
+                throw;
+            }
+            slack = slack < 1024 ? 0 : slack / 2;
+        }
+    }
+}
+
+template <typename Offset, typename Row>
+size_t ColumnArena<Offset, Row>::rowCapacity() const {
+    return row_index_.capacity();
+}
+
+template <typename Offset, typename Row>
+MemoryResource* ColumnArena<Offset, Row>::rowMemory() const {
+    return row_index_.get_allocator().resource();
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::moveRows(MemoryResource* resource) {
+    reallocateRows(row_index_.size(), resource);
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::reallocateRows(size_t size,
+                                              MemoryResource* resource) {
+    // Sized exactly, as resize would round the capacity up.
+    RowVector row_index{DefaultInitAllocator<Row>(resource)};
+    row_index.reserve(size);
+    row_index.insert(row_index.end(), row_index_.begin(),
+                     row_index_.begin() + used_.load());
+    row_index.resize(size);
+    std::swap(row_index_, row_index);
+    PH_TELEMETRY_ONLY(stats_.widen_events++;
+                      stats_.bytes_copied += used_.load() * sizeof(Row);)
+}
+
+template <typename Offset, typename Row>
+bool ColumnArena<Offset, Row>::compactIfFragmented(ExecutionBackend* backend,
+                                                   double max_waste) {
+    size_t n = columnCount();
+    size_t live = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (col_end_[i] != col_start_[i]) {
+            live += col_capacity_[i];
+        }
+    }
+    if (live >= row_index_.size() * (1 - max_waste)) {
+        return false;
+    }
+
+    OffsetVector new_col_start(col_start_.get_allocator());
+    RowVector row_index(row_index_.get_allocator());
+    size_t new_size = 0;
+    try {
+        new_col_start.resize(n);
+        new_size = computePackedLayout(backend, n, col_start_.data(),
+                                       col_end_.data(), col_capacity_.data(),
+                                       new_col_start.data());
+        row_index.resize(new_size);
+    } catch (const MemoryBudgetExceeded&) {
+        return false;
+    }
+    relocateColumns(backend, n, row_index_.data(), col_start_.data(),
+                    col_end_.data(), new_col_start.data(), new_size,
+                    row_index.data());
+    for (size_t i = 0; i < n; i++) {
+        if (col_end_[i] == col_start_[i]) {
+            col_capacity_[i] = 0;
+        }
+    }
+    std::swap(row_index_, row_index);
+    used_ = new_size;
+    PH_TELEMETRY_ONLY(stats_.bytes_copied += new_size * sizeof(Row);)
+
+    for (auto& workspace : workspaces_) {
+        for (auto& free_blocks : workspace->free_blocks) {
+            free_blocks.clear();
+        }
+    }
+    return true;
+}
+
+template <typename Offset, typename Row>
+typename ColumnArena<Offset, Row>::WorkspaceHandle
+ColumnArena<Offset, Row>::borrowWorkspace() {
+    std::unique_lock<std::mutex> lock(workspaces_mutex_);
+    if (idle_workspaces_.empty()) {
+        workspaces_.push_back(std::make_unique<Workspace>());
+        idle_workspaces_.push_back(workspaces_.back().get());
+    }
+    Workspace* workspace = idle_workspaces_.back();
+    idle_workspaces_.pop_back();
+    return WorkspaceHandle(workspace, WorkspaceReturn{this});
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::advise(size_t first_col, size_t last_col,
+                                      MemoryAdvice advice) {
+    MemoryResource* resource = row_index_.get_allocator().resource();
+    if (resource == nullptr) {
+        return;
+    }
+
+    // Blocks less than a page apart are hinted together.
+    const size_t max_gap = 4096 / sizeof(Row);
+    size_t run_start = 0;
+    size_t run_end = 0;
+    auto flush = [&] {
+        if (run_end > run_start) {
+            resource->advise(row_index_.data() + run_start,
+                             (run_end - run_start) * sizeof(Row), advice);
+        }
+    };
+    for (size_t i = first_col; i < last_col; i++) {
+        size_t start = col_start_[i];
+        size_t end = col_end_[i];
+        if (start == end) {
+            continue;
+        }
+        if (start < run_start || start > run_end + max_gap) {
+            flush();
+            run_start = start;
+            run_end = end;
+        } else {
+            run_end = std::max(run_end, end);
+        }
+    }
+    flush();
+}
+
+template <typename Offset, typename Row>
+void ColumnArena<Offset, Row>::firstTouch(ExecutionBackend& backend,
+                                          const std::vector<size_t>& bounds) {
+    size_t n = columnCount();
+    RowVector row_index(row_index_.size(), row_index_.get_allocator());
+    OffsetVector col_start(n, col_start_.get_allocator());
+    OffsetVector col_end(n, col_start_.get_allocator());
+    OffsetVector col_capacity(n, col_start_.get_allocator());
+    RowVector col_base(n, col_start_.get_allocator());
+    auto copy_chunk = [&](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++) {
+            std::memcpy(row_index.data() + col_start_[i],
+                        row_index_.data() + col_start_[i],
+                        col_capacity_[i] * sizeof(Row));
+        }
+        std::copy(col_start_.begin() + start, col_start_.begin() + end,
+                  col_start.begin() + start);
+        std::copy(col_end_.begin() + start, col_end_.begin() + end,
+                  col_end.begin() + start);
+        std::copy(col_capacity_.begin() + start, col_capacity_.begin() + end,
+                  col_capacity.begin() + start);
+        std::copy(col_base_.begin() + start, col_base_.begin() + end,
+                  col_base.begin() + start);
+    };
+    backend.parallelFor("distribute", bounds, copy_chunk);
+
+    std::swap(row_index_, row_index);
+    std::swap(col_start_, col_start);
+    std::swap(col_end_, col_end);
+    std::swap(col_capacity_, col_capacity);
+    std::swap(col_base_, col_base);
+}
+
+#ifdef PH_TELEMETRY
+template <typename Offset, typename Row>
+typename ColumnArena<Offset, Row>::AddStats
+ColumnArena<Offset, Row>::takeStats() {
+    AddStats total = stats_;
+    stats_ = AddStats();
+    for (auto& workspace : workspaces_) {
+        AddStats& stats = workspace->stats;
+        total.additions += stats.additions;
+        total.entries_merged += stats.entries_merged;
+        total.entries_cancelled += stats.entries_cancelled;
+        total.widen_events += stats.widen_events;
+        total.bytes_copied += stats.bytes_copied;
+        stats = AddStats();
+    }
+    return total;
+}
+#endif
+
+template class ColumnArena<uint32_t, uint32_t>;
+template class ColumnArena<uint64_t, uint32_t>;
+template class ColumnArena<uint64_t, uint64_t>;
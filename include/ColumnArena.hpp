@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Allocator.hpp"
+#include "ExecutionBackend.hpp"
+#include "MemoryResource.hpp"
+#include "Telemetry.hpp"
+
+// How the arena stores row indices. Compact stores a column as 16-bit offsets
+// from the start of the 65536-row window holding all of its rows, and falls
+// back to full-width rows for a column that spans windows.
+enum class RowEncoding { Wide, Compact };
+
+struct ArenaOptions {
+        RowEncoding encoding = RowEncoding::Wide;
+        // Charged for the index arrays of a reduction; null means the plain
+        // heap, untracked.
+        std::shared_ptr<MemoryBudget> memory;
+        // Takes the row index array once memory cannot hold it, or from the
+        // start if memory is null or has no limit.
+        std::shared_ptr<MemoryResource> spill_memory;
+};
+
+// Column storage of a sparse matrix. Every column owns a block of one shared
+// row index array. A column that outgrows its block moves alone to a block of
+// the next power-of-two size class; the old block is kept for reuse, so no
+// other column is ever copied. A new block is a free one of its class, else
+// fresh space at the end of the array, else the front of a larger free block
+// that is split.
+//
+// Offset indexes the row index array and Row holds a row index. Instantiated
+// for <uint32_t, uint32_t>, <uint64_t, uint32_t> and <uint64_t, uint64_t>.
+template <typename Offset = uint32_t, typename Row = uint32_t>
+class ColumnArena {
+    public:
+        using OffsetVector = DefaultInitVector<Offset>;
+        using RowVector = DefaultInitVector<Row>;
+
+        // Counted by addColumn and the arena when built with PH_TELEMETRY;
+        // see RoundTelemetry.
+        struct AddStats {
+                uint64_t additions = 0;
+                uint64_t entries_merged = 0;
+                uint64_t entries_cancelled = 0;
+                uint64_t widen_events = 0;
+                uint64_t bytes_copied = 0;
+        };
+
+        // Per-chunk state of addColumn: free blocks by size class and a merge
+        // scratch buffer. A workspace is used by one thread at a time, so
+        // taking and returning blocks never takes a lock.
+        struct Workspace {
+                std::vector<Offset> free_blocks[8 * sizeof(Offset)];
+                RowVector scratch;
+                std::vector<uint16_t> compact_scratch;
+                PH_TELEMETRY_ONLY(AddStats stats;)
+        };
+
+        struct WorkspaceReturn {
+                ColumnArena* arena;
+
+                void operator()(Workspace* workspace) const;
+        };
+
+        using WorkspaceHandle = std::unique_ptr<Workspace, WorkspaceReturn>;
+
+        // Takes over a packed layout: column i starts at col_start[i] and may
+        // use everything up to the next column's start.
+        void assign(RowVector row_index, OffsetVector col_start,
+                    OffsetVector col_end,
+                    RowEncoding encoding = RowEncoding::Wide);
+
+        size_t columnCount() const;
+
+        size_t length(size_t col) const;
+
+        // In words of the row index array, each of which holds several
+        // entries of a compact column.
+        size_t capacity(size_t col) const;
+
+        // Last row index of col, or columnCount() if col is empty.
+        Row low(size_t col) const;
+
+        void clear(size_t col);
+
+        // Clears col and gives its block back for reuse.
+        void discard(size_t col, Workspace& workspace);
+
+        // Adds column add_from to column add_to modulo 2. add_to moves to a
+        // new block if the sum does not fit its own; returns false, leaving
+        // add_to unchanged, if that block cannot be had without growing the
+        // arena. Columns other than add_to and add_from may be modified
+        // concurrently.
+        bool addColumn(size_t add_to, size_t add_from, Workspace& workspace);
+
+        // Moves the free blocks of every workspace into workspace, joining
+        // adjacent ones, so that columns that found their own workspace
+        // short of blocks can be relocated into what the others freed. Not
+        // thread safe.
+        void gatherFreeBlocks(Workspace& workspace);
+
+        // Grows the arena, if needed, so that blocks totalling words can be
+        // handed out without growing again. Growth leaves some slack unless
+        // that is what breaks the memory budget. Not thread safe.
+        void reserve(size_t words);
+
+        // Words allocated for the row index array.
+        size_t rowCapacity() const;
+
+        // Resource behind the row index array, or null for the heap.
+        MemoryResource* rowMemory() const;
+
+        // Moves the row index array to memory from resource. Not thread
+        // safe.
+        void moveRows(MemoryResource* resource);
+
+        // Packs the non-empty columns, with their current capacity, into a
+        // new array if free blocks, blocks of empty columns and unused bump
+        // space make up more than max_waste of the arena. Returns whether it
+        // did; it does not if the memory budget cannot hold the new array.
+        // Not thread safe, and no workspace may be borrowed.
+        bool compactIfFragmented(ExecutionBackend* backend, double max_waste);
+
+        // Size of the block that holds entries full-width rows.
+        static size_t blockSize(size_t entries);
+
+        // Lends out a workspace until the handle goes away. Later chunks
+        // reuse it, along with the free blocks it holds.
+        WorkspaceHandle borrowWorkspace();
+
+        // Passes a paging hint for the blocks of columns [first_col,
+        // last_col) to the resource behind the row index array.
+        void advise(size_t first_col, size_t last_col, MemoryAdvice advice);
+
+        // Recopies every block and the column bookkeeping chunk by chunk, so
+        // that the pages of each chunk are first touched by the thread that
+        // runs it.
+        void firstTouch(ExecutionBackend& backend,
+                        const std::vector<size_t>& bounds);
+
+#ifdef PH_TELEMETRY
+        // Sums the statistics of the arena and every workspace since the
+        // last call, and starts them over. No other thread may be using the
+        // arena.
+        AddStats takeStats();
+#endif
+
+    private:
+        static constexpr size_t entries_per_word = sizeof(Row) / 2;
+        static constexpr Row wide_column = ~(Row)0;
+
+        static bool fitsWindow(Row min_row, Row max_row);
+
+        static Row windowBase(Row row);
+
+        bool isCompact(size_t col) const;
+
+        Row base(size_t col) const;
+
+        // Bytes of the 16-bit entries of a compact column. They live in Row
+        // words, so they are only read and written through memcpy.
+        const unsigned char* compactBytes(size_t col) const;
+
+        unsigned char* compactBytes(size_t col);
+
+        void setCompactLength(size_t col, Row base, size_t len);
+
+        // Moves col to a new block, dropping its rows, if it has fewer than
+        // words words of capacity.
+        bool makeRoom(size_t col, size_t words, Workspace& workspace);
+
+        bool allocate(size_t words, Workspace& workspace, Offset& offset,
+                      Offset& capacity);
+
+        void release(Offset offset, Offset capacity, Workspace& workspace);
+
+        // Replaces row_index_ with an array of size words from resource that
+        // starts with the words handed out so far.
+        void reallocateRows(size_t size, MemoryResource* resource);
+
+        RowVector row_index_;
+        OffsetVector col_start_;
+        OffsetVector col_end_;
+        OffsetVector col_capacity_;
+        // Window base of a compact column, plus the number of unused entries
+        // in its last word, or wide_column.
+        RowVector col_base_;
+        RowEncoding encoding_ = RowEncoding::Wide;
+        // Words of row_index_ handed out so far; the rest is bump space.
+        std::atomic<size_t> used_ = 0;
+        PH_TELEMETRY_ONLY(AddStats stats_;)
+
+        std::mutex workspaces_mutex_;
+        std::vector<std::unique_ptr<Workspace>> workspaces_;
+        std::vector<Workspace*> idle_workspaces_;
+};
@@ -0,0 +1,109 @@
+#include "ColumnProfile.hpp"
+
+#include <algorithm>
+#include <map>
+
+namespace {
+
+// floor(log2(value)) for value >= 1.
+size_t log2Bucket(uint64_t value) {
+    size_t bucket = 0;
+    while (value > 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void writeHistogram(std::ostream& out, const std::vector<uint64_t>& buckets) {
+    for (size_t b = 0; b < buckets.size(); b++) {
+        if (buckets[b] != 0) {
+            out << "  [" << ((uint64_t)1 << b) << ", "
+                << ((uint64_t)1 << (b + 1)) << "): " << buckets[b] << "\n";
+        }
+    }
+}
+
+}  // namespace
+
+void ColumnProfile::start(size_t n) { columns_.assign(n, Column()); }
+
+void ColumnProfile::setInitial(size_t col, uint64_t length, uint64_t low) {
+    Column& column = columns_[col];
+    column.initial_length = length;
+    column.peak_length = length;
+    column.final_length = length;
+    column.dimension =
+        length > 0 && low < col ? columns_[low].dimension + 1 : 0;
+}
+
+void ColumnProfile::addition(size_t col, uint64_t length,
+                             Clock::time_point begin) {
+    Column& column = columns_[col];
+    column.merge_seconds +=
+        std::chrono::duration<double>(Clock::now() - begin).count();
+    column.additions++;
+    column.peak_length = std::max(column.peak_length, length);
+}
+
+void ColumnProfile::report(std::ostream& out, size_t top_k) const {
+    uint64_t additions = 0;
+    uint64_t added_columns = 0;
+    double merge_seconds = 0;
+    std::vector<size_t> heaviest;
+    std::vector<uint64_t> peak_buckets(64);
+    std::vector<uint64_t> growth_buckets(64);
+    std::map<uint32_t, std::pair<uint64_t, uint64_t>> fill_in;
+    for (size_t col = 0; col < columns_.size(); col++) {
+        const Column& column = columns_[col];
+        fill_in[column.dimension].first += column.initial_length;
+        fill_in[column.dimension].second += column.final_length;
+        if (column.additions == 0) {
+            continue;
+        }
+        additions += column.additions;
+        added_columns++;
+        merge_seconds += column.merge_seconds;
+        heaviest.push_back(col);
+        peak_buckets[log2Bucket(std::max<uint64_t>(column.peak_length, 1))]++;
+        growth_buckets[log2Bucket(column.peak_length /
+                                  std::max<uint64_t>(column.initial_length,
+                                                     1))]++;
+    }
+
+    out << "profile: " << additions << " additions to " << added_columns
+        << " columns, " << merge_seconds << " s merging\n";
+
+    auto heavier = [this](size_t a, size_t b) {
+        if (columns_[a].merge_seconds != columns_[b].merge_seconds) {
+            return columns_[a].merge_seconds > columns_[b].merge_seconds;
+        }
+        return columns_[a].additions > columns_[b].additions;
+    };
+    size_t shown = std::min(top_k, heaviest.size());
+    std::partial_sort(heaviest.begin(), heaviest.begin() + shown,
+                      heaviest.end(), heavier);
+    out << "profile: top " << shown << " columns by merge time\n"
+        << "  column dimension additions initial peak final seconds\n";
+    for (size_t k = 0; k < shown; k++) {
+        const Column& column = columns_[heaviest[k]];
+        out << "  " << heaviest[k] << " " << column.dimension << " "
+            << column.additions << " " << column.initial_length << " "
+            << column.peak_length << " " << column.final_length << " "
+            << column.merge_seconds << "\n";
+    }
+
+    out << "profile: peak length of columns with additions\n";
+    writeHistogram(out, peak_buckets);
+    out << "profile: peak length over input length\n";
+    writeHistogram(out, growth_buckets);
+
+    out << "profile: fill-in (final nnz / input nnz) by dimension\n";
+    for (const auto& [dimension, nnz] : fill_in) {
+        out << "  " << dimension << ": " << nnz.first << " -> " << nnz.second;
+        if (nnz.first != 0) {
+            out << ", " << (double)nnz.second / nnz.first;
+        }
+        out << "\n";
+    }
+}
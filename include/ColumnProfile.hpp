@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Per-column statistics of a reduction, to find the few columns that
+// dominate it and how much each dimension fills in. An engine sizes it with
+// start before the first addition; every column is then updated only by the
+// thread adding to it.
+class ColumnProfile {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        struct Column {
+                uint64_t additions = 0;
+                uint64_t initial_length = 0;
+                uint64_t peak_length = 0;
+                uint64_t final_length = 0;
+                double merge_seconds = 0;
+                // Number of boundary steps down to a vertex.
+                uint32_t dimension = 0;
+        };
+
+        // Clears the profile for n columns.
+        void start(size_t n);
+
+        // Sets the input length of col, and its dimension from that of its
+        // last row, which must have been set before.
+        void setInitial(size_t col, uint64_t length, uint64_t low);
+
+        // Counts an addition to col, which then has length entries.
+        void addition(size_t col, uint64_t length, Clock::time_point begin);
+
+        void setFinal(size_t col, uint64_t length) {
+            columns_[col].final_length = length;
+        }
+
+        const std::vector<Column>& columns() const { return columns_; }
+
+        // Writes the top_k columns by merge time, histograms of peak length
+        // and of growth over the input length, and the fill-in of each
+        // dimension.
+        void report(std::ostream& out, size_t top_k) const;
+
+    private:
+        std::vector<Column> columns_;
+};
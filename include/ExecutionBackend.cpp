@@ -0,0 +1,72 @@
+#include "ExecutionBackend.hpp"
+
+#include <stdexcept>
+
+#include "ThreadPoolBackend.hpp"
+#include "Trace.hpp"
+
+#if defined(PH_WITH_OPENMP)
+#include "OpenMPBackend.hpp"
+#endif
+
+#if defined(PH_WITH_TBB)
+#include "TbbBackend.hpp"
+#endif
+
+std::map<std::string, PhaseTiming> ExecutionBackend::phaseTimings() const {
+    std::unique_lock<std::mutex> lock(timings_mutex_);
+    return timings_;
+}
+
+void ExecutionBackend::resetPhaseTimings() {
+    std::unique_lock<std::mutex> lock(timings_mutex_);
+    timings_.clear();
+}
+
+void ExecutionBackend::recordPhase(
+    const char* phase, std::chrono::steady_clock::time_point start) {
+    if (Trace::enabled()) {
+        Trace::record(phase, start);
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::unique_lock<std::mutex> lock(timings_mutex_);
+    PhaseTiming& timing = timings_[phase];
+    timing.calls++;
+    timing.seconds += seconds;
+}
+
+std::vector<std::string> availableExecutionBackends() {
+    std::vector<std::string> names = {"threadpool"};
+#if defined(PH_WITH_OPENMP)
+    names.push_back("openmp");
+#endif
+#if defined(PH_WITH_TBB)
+    names.push_back("tbb");
+#endif
+    return names;
+}
+
+std::shared_ptr<ExecutionBackend> makeExecutionBackend(const std::string& name,
+                                                       size_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = ThreadPool::defaultThreadCount();
+    }
+
+    if (name == "threadpool") {
+        return std::make_shared<ThreadPoolBackend>(
+            std::make_shared<ThreadPool>(num_threads));
+    }
+#if defined(PH_WITH_OPENMP)
+    if (name == "openmp") {
+        return std::make_shared<OpenMPBackend>(num_threads);
+    }
+#endif
+#if defined(PH_WITH_TBB)
+    if (name == "tbb") {
+        return std::make_shared<TbbBackend>(num_threads);
+    }
+#endif
+    throw std::runtime_error("Unknown or unavailable backend: " + name);
+}
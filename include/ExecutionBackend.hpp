@@ -0,0 +1,127 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "PerfCounters.hpp"
+
+// Non-owning reference to a callable. Backends receive chunk bodies through
+// it, which costs one indirect call per chunk and never allocates.
+template <typename Signature>
+class FunctionRef;
+
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+    public:
+        template <typename F, typename = std::enable_if_t<
+                                  !std::is_same_v<F, FunctionRef>>>
+        FunctionRef(F& f)
+            : object_(&f), call_([](void* object, Args... args) -> R {
+                  return (*static_cast<F*>(object))(
+                      std::forward<Args>(args)...);
+              }) {}
+
+        R operator()(Args... args) const {
+            return call_(object_, std::forward<Args>(args)...);
+        }
+
+    private:
+        void* object_;
+        R (*call_)(void*, Args...);
+};
+
+struct PhaseTiming {
+        size_t calls = 0;
+        double seconds = 0;
+};
+
+// Runs the parallel phases of a reduction. Each phase takes a list of chunk
+// bounds and returns once every chunk is done, which is the only barrier the
+// engines need. Wall time is accumulated per phase name.
+class ExecutionBackend {
+    public:
+        using ChunkBody = FunctionRef<void(size_t, size_t)>;
+        using ChunkSum = FunctionRef<uint64_t(size_t, size_t)>;
+
+        virtual ~ExecutionBackend() = default;
+
+        virtual std::string name() const = 0;
+
+        virtual size_t concurrency() const = 0;
+
+        template <typename Body>
+        void parallelFor(const char* phase, const std::vector<size_t>& bounds,
+                         Body&& body) {
+            auto start = std::chrono::steady_clock::now();
+            if (const char* perf_phase = PerfCounters::currentPhase()) {
+                auto counted = countedBody(perf_phase, body);
+                runChunks(bounds, ChunkBody(counted));
+            } else {
+                runChunks(bounds, ChunkBody(body));
+            }
+            recordPhase(phase, start);
+        }
+
+        // Sums body(bounds[c], bounds[c + 1]) over all chunks.
+        template <typename Body>
+        uint64_t parallelSum(const char* phase,
+                             const std::vector<size_t>& bounds, Body&& body) {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t sum;
+            if (const char* perf_phase = PerfCounters::currentPhase()) {
+                auto counted = countedBody(perf_phase, body);
+                sum = sumChunks(bounds, ChunkSum(counted));
+            } else {
+                sum = sumChunks(bounds, ChunkSum(body));
+            }
+            recordPhase(phase, start);
+            return sum;
+        }
+
+        std::map<std::string, PhaseTiming> phaseTimings() const;
+
+        void resetPhaseTimings();
+
+    protected:
+        virtual void runChunks(const std::vector<size_t>& bounds,
+                               ChunkBody body) = 0;
+
+        virtual uint64_t sumChunks(const std::vector<size_t>& bounds,
+                                   ChunkSum body) = 0;
+
+    private:
+        // Wraps body so that other threads count the chunks they run under
+        // perf_phase, the phase of the calling thread, which counts its own.
+        template <typename Body>
+        static auto countedBody(const char* perf_phase, Body& body) {
+            auto caller = std::this_thread::get_id();
+            return [perf_phase, caller, &body](size_t start, size_t end) {
+                PerfPhase counted(
+                    std::this_thread::get_id() == caller ? nullptr
+                                                         : perf_phase,
+                    false);
+                return body(start, end);
+            };
+        }
+
+        void recordPhase(const char* phase,
+                         std::chrono::steady_clock::time_point start);
+
+        mutable std::mutex timings_mutex_;
+        std::map<std::string, PhaseTiming> timings_;
+};
+
+// "threadpool", and "openmp" or "tbb" when built with PH_WITH_OPENMP or
+// PH_WITH_TBB.
+std::vector<std::string> availableExecutionBackends();
+
+std::shared_ptr<ExecutionBackend> makeExecutionBackend(const std::string& name,
+                                                       size_t num_threads);
@@ -1,12 +1,34 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
+#include "ColumnProfile.hpp"
+#include "PersistencePairs.hpp"
+#include "Telemetry.hpp"
+
 class IMatrix {
     public:
         virtual ~IMatrix() = default;
 
-        virtual std::vector<uint32_t> reduce(bool run_twist = true) = 0;
+        // Passes the pair of every column with a non-zero reduced column to
+        // pairs, as (low, column).
+        virtual void reduce(PairSink& pairs, bool run_twist = true) = 0;
 
         virtual size_t size() const = 0;
-};
\ No newline at end of file
+
+        // Bytes currently allocated for the row index array.
+        virtual size_t rowIndexBytes() const = 0;
+
+        // Receives a record per round of reduce when built with
+        // PH_TELEMETRY, and nothing otherwise. Null turns it off.
+        void setTelemetry(TelemetrySink* telemetry) { telemetry_ = telemetry; }
+
+        // Filled by the next reduce, if the engine supports profiling. Null
+        // turns it off.
+        void setProfile(ColumnProfile* profile) { profile_ = profile; }
+
+    protected:
+        TelemetrySink* telemetry_ = nullptr;
+        ColumnProfile* profile_ = nullptr;
+};
@@ -0,0 +1,231 @@
+#include "MemoryResource.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+void MemoryResource::advise(void*, size_t, MemoryAdvice) {}
+
+MappedFileResource::MappedFileResource(const std::string& directory)
+    : directory_(directory) {}
+
+void* MappedFileResource::allocate(size_t bytes) {
+    std::string pattern = directory_ + "/ph-spill-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        throw std::runtime_error("Could not create a spill file in " +
+                                 directory_);
+    }
+    unlink(path.data());
+
+    void* ptr = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0) {
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("Could not map a spill file in " +
+                                 directory_);
+    }
+    return ptr;
+}
+
+void MappedFileResource::deallocate(void* ptr, size_t bytes) {
+    munmap(ptr, bytes);
+}
+
+void MappedFileResource::advise(void* ptr, size_t bytes,
+                                MemoryAdvice advice) {
+    // madvise wants a page-aligned start.
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)ptr & ~(page_size - 1);
+    size_t length = (uintptr_t)ptr + bytes - start;
+
+    int flag = MADV_NORMAL;
+    switch (advice) {
+        case MemoryAdvice::Sequential:
+            flag = MADV_SEQUENTIAL;
+            break;
+        case MemoryAdvice::WillNeed:
+            flag = MADV_WILLNEED;
+            break;
+        case MemoryAdvice::DontNeed:
+            flag = MADV_DONTNEED;
+            break;
+    }
+    madvise((void*)start, length, flag);
+}
+
+HugePageResource::HugePageResource(size_t max_cached)
+    : max_cached_(max_cached) {
+    std::ifstream enabled("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string modes;
+    std::getline(enabled, modes);
+    use_hugetlb_ = modes.find("[never]") != std::string::npos;
+}
+
+std::atomic<size_t> HugePageResource::mapped_bytes_ = 0;
+
+HugePageResource::~HugePageResource() {
+    for (const Mapping& mapping : cached_) {
+        unmap(mapping.ptr, mapping.size);
+    }
+}
+
+size_t HugePageResource::mappedBytes() { return mapped_bytes_.load(); }
+
+size_t HugePageResource::mappingSize(size_t bytes) {
+    return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+}
+
+void* HugePageResource::allocate(size_t bytes) {
+    size_t size = mappingSize(bytes);
+    {
+        // The smallest cached mapping that wastes less than half of itself.
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto best = cached_.end();
+        for (auto it = cached_.begin(); it != cached_.end(); ++it) {
+            if (it->size >= size && it->size < 2 * size &&
+                (best == cached_.end() || it->size < best->size)) {
+                best = it;
+            }
+        }
+        if (best != cached_.end()) {
+            void* ptr = best->ptr;
+            sizes_[ptr] = best->size;
+            cached_bytes_ -= best->size;
+            cached_.erase(best);
+            return ptr;
+        }
+    }
+    void* ptr = map(size);
+    std::unique_lock<std::mutex> lock(mutex_);
+    sizes_[ptr] = size;
+    return ptr;
+}
+
+void HugePageResource::deallocate(void* ptr, size_t) {
+    size_t size;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = sizes_.find(ptr);
+        size = it->second;
+        sizes_.erase(it);
+        if (cached_bytes_ + size <= max_cached_) {
+            cached_.push_back({ptr, size});
+            cached_bytes_ += size;
+            return;
+        }
+    }
+    unmap(ptr, size);
+}
+
+void* HugePageResource::map(size_t size) {
+#ifdef MAP_HUGETLB
+    if (use_hugetlb_) {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            mapped_bytes_ += size;
+            return ptr;
+        }
+    }
+#endif
+
+    // Over-map by a huge page and trim both ends to get the alignment.
+    void* raw = mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    uintptr_t start = (uintptr_t)raw;
+    uintptr_t aligned =
+        (start + huge_page_size - 1) / huge_page_size * huge_page_size;
+    if (aligned > start) {
+        munmap(raw, aligned - start);
+    }
+    uintptr_t tail = aligned + size;
+    uintptr_t end = start + size + huge_page_size;
+    if (end > tail) {
+        munmap((void*)tail, end - tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise((void*)aligned, size, MADV_HUGEPAGE);
+#endif
+    mapped_bytes_ += size;
+    return (void*)aligned;
+}
+
+void HugePageResource::unmap(void* ptr, size_t size) {
+    munmap(ptr, size);
+    mapped_bytes_ -= size;
+}
+
+MemoryBudget::MemoryBudget(uint64_t limit,
+                           std::shared_ptr<MemoryResource> upstream)
+    : limit_(limit), upstream_(std::move(upstream)) {}
+
+void* MemoryBudget::allocate(size_t bytes) {
+    uint64_t current = current_.load();
+    do {
+        if (limit_ != 0 && current + bytes > limit_) {
+            throw MemoryBudgetExceeded("Memory budget of " +
+                                       std::to_string(limit_) +
+                                       " bytes exceeded");
+        }
+    } while (!current_.compare_exchange_weak(current, current + bytes));
+
+    uint64_t peak = peak_.load();
+    while (peak < current + bytes &&
+           !peak_.compare_exchange_weak(peak, current + bytes)) {
+    }
+
+    try {
+        return upstream_ ? upstream_->allocate(bytes) : ::operator new(bytes);
+    } catch (...) {
+        current_ -= bytes;
+        throw;
+    }
+}
+
+void MemoryBudget::deallocate(void* ptr, size_t bytes) {
+    if (upstream_) {
+        upstream_->deallocate(ptr, bytes);
+    } else {
+        ::operator delete(ptr);
+    }
+    current_ -= bytes;
+}
+
+void MemoryBudget::advise(void* ptr, size_t bytes, MemoryAdvice advice) {
+    if (upstream_) {
+        upstream_->advise(ptr, bytes, advice);
+    }
+}
+
+uint64_t MemoryBudget::limit() const { return limit_; }
+
+bool MemoryBudget::fits(uint64_t bytes) const {
+    return limit_ == 0 || current_.load() + bytes <= limit_;
+}
+
+uint64_t MemoryBudget::current() const { return current_.load(); }
+
+uint64_t MemoryBudget::peak() const { return peak_.load(); }
+
+IoUsage processIoUsage() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // Linux counts 512-byte blocks; elsewhere this is an estimate.
+    IoUsage io;
+    io.bytes_read = (uint64_t)usage.ru_inblock * 512;
+    io.bytes_written = (uint64_t)usage.ru_oublock * 512;
+    return io;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class MemoryAdvice { Sequential, WillNeed, DontNeed };
+
+// Source of the memory behind the large index arrays. Vectors reach it
+// through DefaultInitAllocator; a null resource means the heap.
+class MemoryResource {
+    public:
+        virtual ~MemoryResource() = default;
+
+        virtual void* allocate(size_t bytes) = 0;
+
+        virtual void deallocate(void* ptr, size_t bytes) = 0;
+
+        // Paging hint for [ptr, ptr + bytes).
+        virtual void advise(void* ptr, size_t bytes, MemoryAdvice advice);
+};
+
+// Backs every allocation with its own unlinked file in directory, mapped
+// shared, so the kernel can write cold pages back to disk instead of
+// holding them in RAM. Used for out-of-core reductions.
+class MappedFileResource : public MemoryResource {
+    public:
+        MappedFileResource(const std::string& directory);
+
+        void* allocate(size_t bytes) override;
+
+        void deallocate(void* ptr, size_t bytes) override;
+
+        void advise(void* ptr, size_t bytes, MemoryAdvice advice) override;
+
+    private:
+        std::string directory_;
+};
+
+// Anonymous mappings aligned to 2MB and advised MADV_HUGEPAGE, so that the
+// randomly accessed index arrays sit on transparent huge pages and miss the
+// TLB far less. If transparent huge pages are disabled, mappings come from
+// the hugetlbfs pool instead, while it lasts. Freed mappings, up to
+// max_cached bytes, are kept for the next array of a similar size, since
+// the arena reallocates its arrays whenever it grows or is compacted.
+class HugePageResource : public MemoryResource {
+    public:
+        static constexpr size_t huge_page_size = 2 << 20;
+
+        HugePageResource(size_t max_cached = 256 << 20);
+
+        ~HugePageResource() override;
+
+        void* allocate(size_t bytes) override;
+
+        void deallocate(void* ptr, size_t bytes) override;
+
+        // Bytes that all huge page resources have mapped and not yet
+        // unmapped, cached mappings included.
+        static size_t mappedBytes();
+
+    private:
+        struct Mapping {
+                void* ptr;
+                size_t size;
+        };
+
+        static size_t mappingSize(size_t bytes);
+
+        void* map(size_t size);
+
+        void unmap(void* ptr, size_t size);
+
+        static std::atomic<size_t> mapped_bytes_;
+
+        const size_t max_cached_;
+        bool use_hugetlb_ = false;
+        std::mutex mutex_;
+        std::vector<Mapping> cached_;
+        size_t cached_bytes_ = 0;
+        // Size of every mapping handed out, which may exceed what was asked
+        // for when a larger cached mapping is reused.
+        std::unordered_map<void*, size_t> sizes_;
+};
+
+class MemoryBudgetExceeded : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+// Memory from upstream, or the heap if it is null, under a cap. Counts what
+// it hands out, so current and peak usage can be reported, and throws
+// MemoryBudgetExceeded instead of taking the total past limit. Thread safe.
+class MemoryBudget : public MemoryResource {
+    public:
+        // 0 means no cap.
+        MemoryBudget(uint64_t limit = 0,
+                     std::shared_ptr<MemoryResource> upstream = nullptr);
+
+        void* allocate(size_t bytes) override;
+
+        void deallocate(void* ptr, size_t bytes) override;
+
+        void advise(void* ptr, size_t bytes, MemoryAdvice advice) override;
+
+        uint64_t limit() const;
+
+        bool fits(uint64_t bytes) const;
+
+        uint64_t current() const;
+
+        uint64_t peak() const;
+
+    private:
+        const uint64_t limit_;
+        std::shared_ptr<MemoryResource> upstream_;
+        std::atomic<uint64_t> current_ = 0;
+        std::atomic<uint64_t> peak_ = 0;
+};
+
+struct IoUsage {
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+};
+
+// Block I/O of this process so far, as counted by getrusage.
+IoUsage processIoUsage();
@@ -1,9 +1,16 @@
 #include "MetalSparseMatrix.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
 #include <sstream>
 
-MetalSparseMatrix::MetalSparseMatrix(const std::string& file_path) {
+#include "PerfCounters.hpp"
+#include "Relayout.hpp"
+
+MetalSparseMatrix::MetalSparseMatrix(const std::string& file_path,
+                                     std::shared_ptr<ExecutionBackend> backend)
+    : backend_(std::move(backend)) {
     m_pool = NS::AutoreleasePool::alloc()->init();
     m_device = MTL::CreateSystemDefaultDevice();
 
@@ -91,55 +98,41 @@ MetalSparseMatrix::MetalSparseMatrix(const std::string& file_path) {
 
 size_t MetalSparseMatrix::size() const { return n_; }
 
+size_t MetalSparseMatrix::rowIndexBytes() const {
+    return row_index_size_ * sizeof(uint32_t);
+}
+
 void MetalSparseMatrix::widenBuffer(MTL::Buffer* to_add) {
+    PerfPhase perf("widen");
     MTL::Buffer* new_col_start = m_device->newBuffer(
         n_ * sizeof(uint32_t), MTL::ResourceStorageModeShared);
-    auto new_col_start_ptr = (uint32_t*)new_col_start->contents();
-    auto col_start_ptr = (uint32_t*)col_start_->contents();
-    auto col_end_ptr = (uint32_t*)col_end_->contents();
-    auto to_add_ptr = (uint32_t*)to_add->contents();
-
-    uint32_t cur_col_start = 0;
-    for (size_t i = 0; i < n_; i++) {
-        new_col_start_ptr[i] = cur_col_start;
-
-        uint32_t len = col_end_ptr[i] - col_start_ptr[i];
-        uint32_t to_add = to_add_ptr[i];
-        if (len != 0) {
-            cur_col_start +=
-                (i + 1 != n_ ? col_start_ptr[i + 1] : row_index_size_) -
-                col_start_ptr[i];
-
-            if (to_add != n_) {
-                uint32_t to_add_len =
-                    col_end_ptr[to_add] - col_start_ptr[to_add];
-                cur_col_start += std::max((int)to_add_len - 2, (int)len);
-            }
-        }
+    size_t new_size = computeWidenedLayout(
+        backend_.get(), n_, row_index_size_, (uint32_t*)col_start_->contents(),
+        (uint32_t*)col_end_->contents(), (uint32_t*)to_add->contents(),
+        (uint32_t*)new_col_start->contents());
+    if (new_size > std::numeric_limits<uint32_t>::max()) {
+        new_col_start->release();
+        throw std::runtime_error(
+            "Matrix outgrows the 32-bit offsets of the metal engine");
     }
 
-    uint32_t new_size = cur_col_start;
-
-    row_index_buffer_->release();
-    row_index_buffer_ = m_device->newBuffer(new_size * sizeof(uint32_t),
-                                            MTL::ResourceStorageModeShared);
+    MTL::Buffer* new_row_index = m_device->newBuffer(
+        new_size * sizeof(uint32_t), MTL::ResourceStorageModeShared);
 
     std::vector<MTL::Buffer*> buffers = {
-        row_index_, col_start_, col_end_, row_index_buffer_, new_col_start,
+        row_index_, col_start_, col_end_, new_row_index, new_col_start,
     };
     sendComputeCommand(copy_to_new_start_ps, buffers);
 
     row_index_size_ = new_size;
     row_index_->release();
-    row_index_ = row_index_buffer_;
-
-    row_index_buffer_ = m_device->newBuffer(row_index_size_ * sizeof(uint32_t),
-                                            MTL::ResourceStorageModeShared);
+    row_index_ = new_row_index;
 
     new_col_start->release();
 }
 
 void MetalSparseMatrix::readFromFile(const std::string& file_path) {
+    PerfPhase perf("parse");
     std::ifstream file(file_path);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file");
@@ -162,6 +155,10 @@ void MetalSparseMatrix::readFromFile(const std::string& file_path) {
         std::istringstream iss(line);
         if (i == 0) {
             iss >> n_;
+            if (n_ >= std::numeric_limits<uint32_t>::max()) {
+                throw std::runtime_error(
+                    "Too many columns for the metal engine");
+            }
             col_start_ = m_device->newBuffer(n_ * sizeof(uint32_t),
                                              MTL::ResourceStorageModeShared);
             col_end_ = m_device->newBuffer(n_ * sizeof(uint32_t),
@@ -176,6 +173,11 @@ void MetalSparseMatrix::readFromFile(const std::string& file_path) {
                 count++;
                 row_index.push_back(index);
             }
+            if (row_index.size() > std::numeric_limits<uint32_t>::max()) {
+                throw std::runtime_error(
+                    "Too many entries for the 32-bit offsets of the metal "
+                    "engine");
+            }
 
             if (i < n_) {
                 col_start_ptr[i] = col_start_ptr[i - 1] + count;
@@ -194,8 +196,6 @@ void MetalSparseMatrix::readFromFile(const std::string& file_path) {
     for (size_t i = 0; i < row_index.size(); i++) {
         row_index_ptr[i] = row_index[i];
     }
-    row_index_buffer_ = m_device->newBuffer(row_index_size_ * sizeof(uint32_t),
-                                            MTL::ResourceStorageModeShared);
 }
 
 void MetalSparseMatrix::sendComputeCommand(MTL::ComputePipelineState* ps,
@@ -226,8 +226,9 @@ void MetalSparseMatrix::sendComputeCommand(MTL::ComputePipelineState* ps,
     commandBuffer->waitUntilCompleted();
 }
 
-std::vector<uint32_t> MetalSparseMatrix::reduce(bool run_twist) {
+void MetalSparseMatrix::reduce(PairSink& pairs, bool run_twist) {
     if (run_twist) {
+        PerfPhase perf("twist");
         std::vector<MTL::Buffer*> buffers = {
             col_start_,
             col_end_,
@@ -269,11 +270,22 @@ std::vector<uint32_t> MetalSparseMatrix::reduce(bool run_twist) {
     auto col_end_ptr = (uint32_t*)col_end_->contents();
     auto row_index_ptr = (uint32_t*)row_index_->contents();
 
+#ifdef PH_TELEMETRY
+    auto to_add_ptr = (uint32_t*)to_add->contents();
+    size_t rounds = 0;
+#endif
     while (true) {
+#ifdef PH_TELEMETRY
+        RoundTelemetry round;
+        round.engine = "sparse-metal";
+        round.round = rounds++;
+        RoundClock clock(round);
+#endif
         std::vector<MTL::Buffer*> buffers = {
             row_index_, col_start_, col_end_, inverse_low, n_buffer,
         };
         sendComputeCommand(count_inverse_low_ps, buffers);
+        PH_TELEMETRY_ONLY(clock.lap("count-inverse-low");)
 
         *is_over_ptr = 1;
         buffers = {
@@ -288,22 +300,54 @@ std::vector<uint32_t> MetalSparseMatrix::reduce(bool run_twist) {
             need_widen_buffer,
         };
         sendComputeCommand(count_to_add_ps, buffers);
+        PH_TELEMETRY_ONLY(clock.lap("count-to-add");)
 
         if (*is_over_ptr == 1) {
+            PH_TELEMETRY_ONLY(recordRound(round);)
             break;
         }
 
         if (*need_widen_buffer_ptr == 1) {
+#ifdef PH_TELEMETRY
+            round.widen_events++;
+            for (size_t i = 0; i < n_; i++) {
+                round.bytes_copied +=
+                    (col_end_ptr[i] - col_start_ptr[i]) * sizeof(uint32_t);
+            }
+#endif
             widenBuffer(to_add);
             row_index_ptr = (uint32_t*)row_index_->contents();
             *need_widen_buffer_ptr = 0;
+            PH_TELEMETRY_ONLY(clock.lap("widen");)
         }
 
+#ifdef PH_TELEMETRY
+        // Lengths of the columns about to be added to, before and after.
+        for (size_t i = 0; i < n_; i++) {
+            if (to_add_ptr[i] != n_) {
+                round.active_columns++;
+                round.entries_merged += col_end_ptr[i] - col_start_ptr[i] +
+                                        col_end_ptr[to_add_ptr[i]] -
+                                        col_start_ptr[to_add_ptr[i]];
+            }
+        }
+        round.additions = round.active_columns;
+#endif
         buffers = {
-            col_start_,        col_end_, row_index_,
-            row_index_buffer_, to_add,   n_buffer,
+            col_start_, col_end_, row_index_, to_add, n_buffer,
         };
         sendComputeCommand(add_columns_ps, buffers);
+#ifdef PH_TELEMETRY
+        clock.lap("add-columns");
+        uint64_t entries_left = 0;
+        for (size_t i = 0; i < n_; i++) {
+            if (to_add_ptr[i] != n_) {
+                entries_left += col_end_ptr[i] - col_start_ptr[i];
+            }
+        }
+        round.entries_cancelled = round.entries_merged - entries_left;
+        recordRound(round);
+#endif
     }
 
     to_add->release();
@@ -313,19 +357,32 @@ std::vector<uint32_t> MetalSparseMatrix::reduce(bool run_twist) {
     row_index_size_buffer->release();
     need_widen_buffer->release();
 
-    std::vector<uint32_t> lowArray(n_);
+    PerfPhase perf("output");
+    for (size_t i = 0; i < n_; i++) {
+        if (col_start_ptr[i] != col_end_ptr[i]) {
+            pairs.addPair(row_index_ptr[col_end_ptr[i] - 1], i);
+        }
+    }
+}
+
+#ifdef PH_TELEMETRY
+void MetalSparseMatrix::recordRound(RoundTelemetry& round) {
+    if (!telemetry_) {
+        return;
+    }
+    auto col_start_ptr = (uint32_t*)col_start_->contents();
+    auto col_end_ptr = (uint32_t*)col_end_->contents();
     for (size_t i = 0; i < n_; i++) {
-        lowArray[i] = (col_start_ptr[i] == col_end_ptr[i]
-                           ? n_
-                           : row_index_ptr[col_end_ptr[i] - 1]);
+        round.max_column_length = std::max<uint64_t>(
+            round.max_column_length, col_end_ptr[i] - col_start_ptr[i]);
     }
-    return lowArray;
+    telemetry_->addRound(round);
 }
+#endif
 
 MetalSparseMatrix::~MetalSparseMatrix() {
     col_start_->release();
     col_end_->release();
     row_index_->release();
-    row_index_buffer_->release();
     m_pool->release();
 }
@@ -1,34 +1,45 @@
 #pragma once
 
 #include <Metal/Metal.hpp>
+#include <memory>
 
+#include "ExecutionBackend.hpp"
 #include "IMatrix.hpp"
 
 class MetalSparseMatrix : public IMatrix {
     public:
-        MetalSparseMatrix(const std::string& file_path);
+        MetalSparseMatrix(const std::string& file_path,
+                          std::shared_ptr<ExecutionBackend> backend = nullptr);
 
-        std::vector<uint32_t> reduce(bool run_twist = true) override;
+        void reduce(PairSink& pairs, bool run_twist = true) override;
 
         size_t size() const override;
 
+        size_t rowIndexBytes() const override;
+
         ~MetalSparseMatrix();
 
     private:
         void widenBuffer(MTL::Buffer* need_widen_buffer);
 
+#ifdef PH_TELEMETRY
+        // Fills in the longest column and passes round to telemetry_.
+        void recordRound(RoundTelemetry& round);
+#endif
+
         void readFromFile(const std::string& file_path);
 
         void sendComputeCommand(MTL::ComputePipelineState* ps,
                                 std::vector<MTL::Buffer*> buffers);
 
+        std::shared_ptr<ExecutionBackend> backend_;
+
         size_t n_;
         MTL::Buffer* col_start_;
         MTL::Buffer* col_end_;
 
         size_t row_index_size_;
         MTL::Buffer* row_index_;
-        MTL::Buffer* row_index_buffer_;
 
         NS::AutoreleasePool* m_pool;
         MTL::Device* m_device;
@@ -0,0 +1,48 @@
+#include "OpenMPBackend.hpp"
+
+#include <exception>
+#include <omp.h>
+
+OpenMPBackend::OpenMPBackend(size_t num_threads) : num_threads_(num_threads) {}
+
+std::string OpenMPBackend::name() const { return "openmp"; }
+
+size_t OpenMPBackend::concurrency() const { return num_threads_; }
+
+void OpenMPBackend::runChunks(const std::vector<size_t>& bounds,
+                              ChunkBody body) {
+    auto run = [&](size_t start, size_t end) -> uint64_t {
+        body(start, end);
+        return 0;
+    };
+    sumChunks(bounds, run);
+}
+
+uint64_t OpenMPBackend::sumChunks(const std::vector<size_t>& bounds,
+                                  ChunkSum body) {
+    if (bounds.size() < 2) {
+        return 0;
+    }
+
+    // Exceptions must not leave a parallel region, so the first one is
+    // carried out and rethrown.
+    std::exception_ptr error;
+    uint64_t sum = 0;
+    long chunk_count = bounds.size() - 1;
+#pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads_) \
+    reduction(+ : sum)
+    for (long c = 0; c < chunk_count; c++) {
+        try {
+            sum += body(bounds[c], bounds[c + 1]);
+        } catch (...) {
+#pragma omp critical
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return sum;
+}
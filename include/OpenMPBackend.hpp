@@ -0,0 +1,22 @@
+#pragma once
+
+#include "ExecutionBackend.hpp"
+
+class OpenMPBackend : public ExecutionBackend {
+    public:
+        OpenMPBackend(size_t num_threads);
+
+        std::string name() const override;
+
+        size_t concurrency() const override;
+
+    protected:
+        void runChunks(const std::vector<size_t>& bounds,
+                       ChunkBody body) override;
+
+        uint64_t sumChunks(const std::vector<size_t>& bounds,
+                           ChunkSum body) override;
+
+    private:
+        int num_threads_;
+};
@@ -1,151 +1,328 @@
 #include "ParallelSparseMatrix.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <ctime>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 
-#include "ThreadPool.hpp"
+#include "PerfCounters.hpp"
+#include "ThreadPoolBackend.hpp"
 
-void addTasksAndWait(ThreadPool& pool, size_t n_,
-                     std::function<void(size_t)> task) {
-    const size_t batch_size = 10000;
-    size_t batch_count = (n_ + batch_size - 1) / batch_size;
+template <typename Offset, typename Row>
+ParallelSparseMatrix<Offset, Row>::ParallelSparseMatrix(
+    const std::string& file_path, std::shared_ptr<ExecutionBackend> backend,
+    const ArenaOptions& options)
+    : Base(file_path, options), backend_(std::move(backend)) {
+    setUp();
+}
 
-    std::condition_variable cv;
-    size_t tasks_completed = 0;
-    std::mutex mutex;
+template <typename Offset, typename Row>
+ParallelSparseMatrix<Offset, Row>::ParallelSparseMatrix(
+    std::istream& input, std::shared_ptr<ExecutionBackend> backend,
+    const ArenaOptions& options)
+    : Base(input, options), backend_(std::move(backend)) {
+    setUp();
+}
 
-    for (size_t batch_num = 0; batch_num < batch_count; batch_num++) {
-        pool.enqueue(
-            [&cv, &tasks_completed, &mutex, batch_count, batch_num, n_, task] {
-                size_t start = batch_num * batch_size;
-                size_t end = std::min(start + batch_size, n_);
-                for (size_t i = start; i < end; i++) {
-                    task(i);
-                }
+template <typename Offset, typename Row>
+ParallelSparseMatrix<Offset, Row>::ParallelSparseMatrix(
+    size_t n, DefaultInitVector<Offset> col_ptr,
+    DefaultInitVector<Row> row_index,
+    std::shared_ptr<ExecutionBackend> backend, const ArenaOptions& options)
+    : Base(n, std::move(col_ptr), std::move(row_index), options),
+      backend_(std::move(backend)) {
+    setUp();
+}
 
-                {
-                    std::unique_lock<std::mutex> lock(mutex);
-                    if (++tasks_completed == batch_count) {
-                        cv.notify_one();
-                    }
-                }
-            });
+template <typename Offset, typename Row>
+void ParallelSparseMatrix<Offset, Row>::setUp() {
+    if (n_ >= (uint64_t)1 << owner_col_bits) {
+        throw std::runtime_error("Too many columns for the parallel engine");
+    }
+    if (!backend_) {
+        backend_ = std::make_shared<ThreadPoolBackend>();
+    }
+    if (ThreadPool::numaNodeCount() > 1) {
+        columns_.firstTouch(*backend_, capacityChunks());
+    }
+}
+
+template <typename Offset, typename Row>
+uint64_t ParallelSparseMatrix<Offset, Row>::packOwner(uint64_t generation,
+                                                      size_t col) {
+    uint64_t col_mask = ((uint64_t)1 << owner_col_bits) - 1;
+    return generation << owner_col_bits | (~(uint64_t)col & col_mask);
+}
+
+template <typename Offset, typename Row>
+size_t ParallelSparseMatrix<Offset, Row>::unpackOwner(uint64_t owner) {
+    uint64_t col_mask = ((uint64_t)1 << owner_col_bits) - 1;
+    return ~owner & col_mask;
+}
+
+template <typename Offset, typename Row>
+size_t ParallelSparseMatrix<Offset, Row>::chunkCount() const {
+    size_t block_count = (n_ + block_size_ - 1) / block_size_;
+    return std::max<size_t>(
+        1, std::min(block_count, backend_->concurrency() * chunks_per_thread_));
+}
+
+template <typename Offset, typename Row>
+std::vector<size_t> ParallelSparseMatrix<Offset, Row>::weightedChunks(
+    const std::vector<uint64_t>& block_work) const {
+    uint64_t total_work = 0;
+    for (uint64_t work : block_work) {
+        total_work += work;
+    }
+    size_t chunk_count = chunkCount();
+
+    std::vector<size_t> bounds = {0};
+    uint64_t cur_work = 0;
+    for (size_t b = 0; b < block_work.size(); b++) {
+        cur_work += block_work[b];
+        size_t end = std::min(n_, (b + 1) * block_size_);
+        if (end != n_ &&
+            cur_work * chunk_count >= total_work * bounds.size()) {
+            bounds.push_back(end);
+        }
     }
+    bounds.push_back(n_);
+    return bounds;
+}
 
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        cv.wait(lock, [&] { return tasks_completed == batch_count; });
+template <typename Offset, typename Row>
+std::vector<uint64_t> ParallelSparseMatrix<Offset, Row>::capacityBlockWork()
+    const {
+    std::vector<uint64_t> block_work((n_ + block_size_ - 1) / block_size_);
+    for (size_t b = 0; b < block_work.size(); b++) {
+        size_t start = b * block_size_;
+        size_t end = std::min(n_, start + block_size_);
+        uint64_t work = end - start;
+        for (size_t i = start; i < end; i++) {
+            work += columns_.capacity(i);
+        }
+        block_work[b] = work;
     }
+    return block_work;
 }
 
-ParallelSparseMatrix::ParallelSparseMatrix(const std::string& file_path)
-    : SparseMatrixBase(file_path) {}
+template <typename Offset, typename Row>
+std::vector<size_t> ParallelSparseMatrix<Offset, Row>::capacityChunks() const {
+    return weightedChunks(capacityBlockWork());
+}
 
-std::vector<uint32_t> ParallelSparseMatrix::reduce(bool run_twist) {
+template <typename Offset, typename Row>
+void ParallelSparseMatrix<Offset, Row>::reduce(PairSink& pairs,
+                                               bool run_twist) {
+    startProfile();
     if (run_twist) {
         runTwist();
     }
 
-    std::atomic<bool> need_widen_buffer = false;
-    ThreadPool pool;
+    ExecutionBackend& backend = *backend_;
 
-    std::vector<uint32_t> row_index_buffer(row_index_.size(), 0);
-    std::vector<uint32_t> to_add(n_, n_);
-    std::vector<std::atomic<uint32_t>> inverse_low(n_);
-    for (auto& i : inverse_low) {
-        i.store(n_);
-    }
-    while (true) {
-        addTasksAndWait(pool, n_, [&](size_t i) {
-            uint32_t cur_low = getLow(i);
-            if (cur_low != n_) {
-                while (true) {
-                    uint32_t cur_value =
-                        inverse_low[cur_low].load(std::memory_order_relaxed);
-                    if (i > cur_value) {
-                        break;
-                    }
-                    if (inverse_low[cur_low].compare_exchange_weak(
-                            cur_value, i, std::memory_order_relaxed)) {
-                        break;
-                    }
-                }
-            }
-        });
-
-        addTasksAndWait(pool, n_, [&](size_t i) {
-            uint32_t cur_low = getLow(i);
-            if (cur_low != n_ &&
-                inverse_low[cur_low].load(std::memory_order_relaxed) != i) {
-                to_add[i] =
-                    inverse_low[cur_low].load(std::memory_order_relaxed);
-            }
+    // Chunks of equal storage, the ones setUp placed the columns by.
+    std::vector<size_t> pivot_chunks = capacityChunks();
+    bool numa = ThreadPool::numaNodeCount() > 1;
+    std::vector<uint64_t> block_work = capacityBlockWork();
 
-            if (!need_widen_buffer.load() &&
-                !enoughSizeForIteration(i, to_add[i])) {
-                need_widen_buffer.store(true, std::memory_order_relaxed);
-            }
-        });
+    // The rows move to spill memory if the budget cannot also take these.
+    auto to_add = allocateRelieving(&backend, [&] {
+        return DefaultInitVector<Row>(n_, n_, memory_.get());
+    });
+    auto pivot_owner = allocateRelieving(&backend, [&] {
+        return DefaultInitVector<std::atomic<uint64_t>>(n_, memory_.get());
+    });
+    for (auto& owner : pivot_owner) {
+        owner.store(0, std::memory_order_relaxed);
+    }
 
-        bool is_over = true;
-        for (size_t i = 0; i < n_; i++) {
-            if (to_add[i] != n_) {
-                is_over = false;
-                break;
+    std::mutex deferred_mutex;
+    std::vector<Row> deferred;
+    PH_TELEMETRY_ONLY(RoundTelemetry round; round.engine = "sparse-parallel";)
+    for (uint64_t pass = 0;; pass++) {
+        uint64_t generation = pass % max_generation + 1;
+        if (generation == 1 && pass > 0) {
+            for (auto& owner : pivot_owner) {
+                owner.store(0, std::memory_order_relaxed);
             }
         }
-        if (is_over) {
-            break;
+#ifdef PH_TELEMETRY
+        if (pass > 0) {
+            recordRound(round);
         }
+        RoundClock clock(round);
+#endif
+        auto find_pivot_owners = [&](size_t start, size_t end) {
+            for (size_t i = start; i < end; i++) {
+                Row cur_low = getLow(i);
+                if (cur_low == n_) {
+                    continue;
+                }
 
-        if (need_widen_buffer.load()) {
-            std::vector<uint32_t> new_col_start(n_);
-
-            uint32_t cur_col_start = 0;
-            for (size_t i = 0; i < n_; i++) {
-                new_col_start[i] = cur_col_start;
-
-                uint32_t len = col_end_[i] - col_start_[i];
-                cur_col_start += widen_coef_ * len;
-                if (len != 0) {
-                    cur_col_start += (i == n_ - 1 ? (uint32_t)row_index_.size()
-                                                  : col_start_[i + 1]) -
-                                     col_end_[i];
+                uint64_t owner = packOwner(generation, i);
+                uint64_t cur_owner =
+                    pivot_owner[cur_low].load(std::memory_order_relaxed);
+                while (cur_owner < owner &&
+                       !pivot_owner[cur_low].compare_exchange_weak(
+                           cur_owner, owner, std::memory_order_relaxed)) {
                 }
             }
+        };
+        {
+            PerfPhase perf("pivot");
+            backend.parallelFor("pivot", pivot_chunks, find_pivot_owners);
+        }
+        PH_TELEMETRY_ONLY(clock.lap("pivot");)
 
-            uint32_t new_size = cur_col_start;
+        // Every column before the first one that has work is final.
+        std::atomic<size_t> first_pending = n_;
+        auto resolve_and_add = [&](size_t start, size_t end) -> uint64_t {
+            auto workspace = columns_.borrowWorkspace();
+            uint64_t chunk_work_columns = 0;
+            size_t chunk_first_pending = n_;
+            std::vector<Row> chunk_deferred;
+            for (size_t block_start = start; block_start < end;
+                 block_start += block_size_) {
+                size_t block_end = std::min(end, block_start + block_size_);
+                uint64_t work = block_end - block_start;
+                columns_.advise(block_start, block_end,
+                                MemoryAdvice::WillNeed);
+                for (size_t i = block_start; i < block_end; i++) {
+                    Row cur_low = getLow(i);
+                    if (cur_low == n_) {
+                        continue;
+                    }
 
-            row_index_buffer.resize(new_size, 0);
+                    size_t owner = unpackOwner(
+                        pivot_owner[cur_low].load(std::memory_order_relaxed));
+                    if (owner == i) {
+                        continue;
+                    }
 
-            addTasksAndWait(pool, n_, [&](size_t i) {
-                int start = col_start_[i];
-                int end = col_end_[i];
-                int new_start = new_col_start[i];
+                    chunk_work_columns++;
+                    chunk_first_pending = std::min(chunk_first_pending, i);
+                    work += columns_.length(i) + columns_.length(owner);
+                    if (!addColumn(i, owner, *workspace)) {
+                        to_add[i] = owner;
+                        chunk_deferred.push_back(i);
+                    }
+                }
+                block_work[block_start / block_size_] = work;
+            }
 
-                std::copy(row_index_.begin() + start, row_index_.begin() + end,
-                          row_index_buffer.begin() + new_start);
+            if (!chunk_deferred.empty()) {
+                std::unique_lock<std::mutex> lock(deferred_mutex);
+                deferred.insert(deferred.end(), chunk_deferred.begin(),
+                                chunk_deferred.end());
+            }
+            size_t cur_first = first_pending.load();
+            while (chunk_first_pending < cur_first &&
+                   !first_pending.compare_exchange_weak(cur_first,
+                                                        chunk_first_pending)) {
+            }
+            return chunk_work_columns;
+        };
+        // On NUMA machines columns stay on the chunks they were first
+        // touched by, and stealing evens out the work. Elsewhere chunks
+        // follow the work of the last round.
+        uint64_t columns_with_work;
+        {
+            PerfPhase perf("add");
+            columns_with_work = backend.parallelSum(
+                "resolve-add",
+                numa ? pivot_chunks : weightedChunks(block_work),
+                resolve_and_add);
+        }
 
-                col_start_[i] = new_start;
-                col_end_[i] = new_start + (end - start);
-            });
+        finalizeColumns(first_pending.load(), pairs);
+        PH_TELEMETRY_ONLY(clock.lap("resolve-add");
+                          round.active_columns = columns_with_work;)
+        if (columns_with_work == 0) {
+            PH_TELEMETRY_ONLY(recordRound(round);)
+            break;
+        }
+        {
+            PerfPhase perf("widen");
+            if (columns_.compactIfFragmented(&backend, max_arena_waste_)) {
+                pivot_chunks = capacityChunks();
+            }
+        }
+        PH_TELEMETRY_ONLY(clock.lap("compact");)
+        if (deferred.empty()) {
+            continue;
+        }
 
-            row_index_.resize(new_size, 0);
-            std::swap(row_index_, row_index_buffer);
+        PerfPhase perf("add");
+        // Columns that found their chunk's blocks and the arena's spare
+        // space used up move first into blocks that other chunks freed.
+        // Every other column has already been added, so only these are
+        // relocated, and the arena grows for the ones that still do not fit.
+        {
+            auto workspace = columns_.borrowWorkspace();
+            columns_.gatherFreeBlocks(*workspace);
+            size_t still_deferred = 0;
+            for (Row i : deferred) {
+                if (addColumn(i, to_add[i], *workspace)) {
+                    to_add[i] = n_;
+                } else {
+                    deferred[still_deferred++] = i;
+                }
+            }
+            deferred.resize(still_deferred);
+        }
+        PH_TELEMETRY_ONLY(clock.lap("relocate");)
+        if (deferred.empty()) {
+            continue;
         }
-        need_widen_buffer.store(false);
 
-        addTasksAndWait(pool, n_, [&](size_t i) {
-            if (to_add[i] != n_) {
-                addColumn(i, to_add[i], row_index_buffer);
+        // The rest are added once the arena has grown by enough for all of
+        // them. If the memory budget cannot take that, they are added one by
+        // one instead, each growing the arena by only what it needs.
+        size_t deferred_entries = 0;
+        for (Row i : deferred) {
+            deferred_entries += columns_.blockSize(
+                columns_.length(i) + columns_.length(to_add[i]));
+        }
+        try {
+            growColumns(&backend, deferred_entries);
+        } catch (const MemoryBudgetExceeded&) {
+            auto workspace = columns_.borrowWorkspace();
+            for (Row i : deferred) {
+                addColumnGrowing(i, to_add[i], workspace, &backend);
                 to_add[i] = n_;
             }
+            deferred.clear();
+            pivot_chunks = capacityChunks();
+            PH_TELEMETRY_ONLY(clock.lap("deferred-add");)
+            continue;
+        }
 
-            inverse_low[i].store(n_);
-        });
+        std::vector<size_t> deferred_chunks(chunkCount() + 1);
+        for (size_t c = 0; c < deferred_chunks.size(); c++) {
+            deferred_chunks[c] =
+                deferred.size() * c / (deferred_chunks.size() - 1);
+        }
+        auto add_deferred = [&](size_t start, size_t end) {
+            auto workspace = columns_.borrowWorkspace();
+            for (size_t k = start; k < end; k++) {
+                Row i = deferred[k];
+                if (!addColumn(i, to_add[i], *workspace)) {
+                    throw std::runtime_error("Column arena exhausted");
+                }
+                to_add[i] = n_;
+            }
+        };
+        backend.parallelFor("deferred-add", deferred_chunks, add_deferred);
+        deferred.clear();
+        pivot_chunks = capacityChunks();
+        PH_TELEMETRY_ONLY(clock.lap("deferred-add");)
     }
-
-    return getLowArray();
 }
+
+template class ParallelSparseMatrix<uint32_t, uint32_t>;
+template class ParallelSparseMatrix<uint64_t, uint32_t>;
+template class ParallelSparseMatrix<uint64_t, uint64_t>;
@@ -1,10 +1,89 @@
 #pragma once
 
+#include <memory>
+
+#include "ExecutionBackend.hpp"
 #include "SparseMatrixBase.hpp"
 
-class ParallelSparseMatrix : public SparseMatrixBase {
+template <typename Offset = uint32_t, typename Row = uint32_t>
+class ParallelSparseMatrix : public SparseMatrixBase<Offset, Row> {
     public:
-        ParallelSparseMatrix(const std::string& file_path);
+        ParallelSparseMatrix(
+            const std::string& file_path,
+            std::shared_ptr<ExecutionBackend> backend = nullptr,
+            const ArenaOptions& options = {});
+
+        ParallelSparseMatrix(
+            std::istream& input,
+            std::shared_ptr<ExecutionBackend> backend = nullptr,
+            const ArenaOptions& options = {});
+
+        // In-memory columns; see SparseMatrixBase.
+        ParallelSparseMatrix(
+            size_t n, DefaultInitVector<Offset> col_ptr,
+            DefaultInitVector<Row> row_index,
+            std::shared_ptr<ExecutionBackend> backend = nullptr,
+            const ArenaOptions& options = {});
+
+        template <typename Ptr, typename Index>
+        ParallelSparseMatrix(
+            const CscSpan<Ptr, Index>& csc,
+            std::shared_ptr<ExecutionBackend> backend = nullptr,
+            const ArenaOptions& options = {})
+            : Base(csc, options), backend_(std::move(backend)) {
+            setUp();
+        }
+
+        void reduce(PairSink& pairs, bool run_twist = true) override;
+
+    private:
+        using Base = SparseMatrixBase<Offset, Row>;
+        using Base::addColumn;
+        using Base::addColumnGrowing;
+        using Base::allocateRelieving;
+        using Base::columns_;
+        using Base::finalizeColumns;
+        using Base::getLow;
+        using Base::growColumns;
+        using Base::max_arena_waste_;
+        using Base::memory_;
+        using Base::n_;
+        using Base::runTwist;
+        using Base::startProfile;
+        PH_TELEMETRY_ONLY(using Base::recordRound;)
+
+        // Pivot owners are packed as (generation, ~column) so that a plain
+        // atomic max keeps the lowest column of the current round and a
+        // stale entry from an earlier round never has to be reset. Columns
+        // take the low 32 bits, or 40 with 64-bit rows.
+        static constexpr uint32_t owner_col_bits = sizeof(Row) == 4 ? 32 : 40;
+        // Generations left in the remaining bits. Once they run out, every
+        // owner is reset and counting starts over.
+        static constexpr uint64_t max_generation =
+            ~(uint64_t)0 >> owner_col_bits;
+
+        static uint64_t packOwner(uint64_t generation, size_t col);
+
+        static size_t unpackOwner(uint64_t owner);
+
+        // Checks n_, picks a default backend if none was given and spreads
+        // the columns over the NUMA nodes.
+        void setUp();
+
+        size_t chunkCount() const;
+
+        std::vector<size_t> weightedChunks(
+            const std::vector<uint64_t>& block_work) const;
+
+        std::vector<uint64_t> capacityBlockWork() const;
+
+        // Chunks holding equal shares of the column storage. The thread pool
+        // backend hands each worker the same run of these chunks every time,
+        // so they double as the column-to-thread assignment for first-touch
+        // placement.
+        std::vector<size_t> capacityChunks() const;
 
-        std::vector<uint32_t> reduce(bool run_twist = true) override;
+        std::shared_ptr<ExecutionBackend> backend_;
+        const size_t block_size_ = 1024;
+        const size_t chunks_per_thread_ = 8;
 };
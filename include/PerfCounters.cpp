@@ -0,0 +1,190 @@
+#include "PerfCounters.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t counter_count = 5;
+
+struct Reading {
+        std::chrono::steady_clock::time_point wall;
+        double cpu_seconds;
+        uint64_t events[counter_count];
+};
+
+// Phase stack and, once hardware counting is on, a counter group led by
+// cycles. Members the kernel refuses, such as dTLB misses in many VMs, read
+// as 0.
+class ThreadCounters {
+    public:
+        ~ThreadCounters() {
+#if defined(__linux__)
+            for (int fd : fds_) {
+                close(fd);
+            }
+#endif
+        }
+
+        // Opens the counter group unless that has been tried already.
+        void openHardware() {
+            if (tried_) {
+                return;
+            }
+            tried_ = true;
+#if defined(__linux__)
+            const uint64_t dtlb_read_miss =
+                PERF_COUNT_HW_CACHE_DTLB |
+                PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+            const std::pair<uint32_t, uint64_t> events[counter_count] = {
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_HW_CACHE, dtlb_read_miss},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            };
+            for (size_t c = 0; c < counter_count; c++) {
+                perf_event_attr attr = {};
+                attr.size = sizeof(attr);
+                attr.type = events[c].first;
+                attr.config = events[c].second;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+                int fd = syscall(SYS_perf_event_open, &attr, 0, -1,
+                                 leader_, 0);
+                if (c == 0 && fd < 0) {
+                    return;
+                }
+                if (c == 0) {
+                    leader_ = fd;
+                }
+                if (fd >= 0) {
+                    fds_.push_back(fd);
+                    slots_.push_back(c);
+                }
+            }
+#endif
+        }
+
+        bool hardwareOpen() const { return leader_ >= 0; }
+
+        Reading read() const {
+            Reading reading = {std::chrono::steady_clock::now(), 0, {}};
+            timespec cpu;
+            if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0) {
+                reading.cpu_seconds = cpu.tv_sec + cpu.tv_nsec / 1e9;
+            }
+#if defined(__linux__)
+            uint64_t group[counter_count + 1] = {};
+            if (leader_ >= 0 && ::read(leader_, group, sizeof(group)) > 0) {
+                for (size_t k = 0; k < group[0] && k < slots_.size(); k++) {
+                    reading.events[slots_[k]] = group[k + 1];
+                }
+            }
+#endif
+            return reading;
+        }
+
+        // Innermost phase last, with whether it counts wall time, and the
+        // reading at which it was last resumed.
+        std::vector<std::pair<const char*, bool>> phases;
+        Reading resumed;
+
+    private:
+        bool tried_ = false;
+        int leader_ = -1;
+        std::vector<int> fds_;
+        // Counter of each group member, in read order.
+        std::vector<size_t> slots_;
+};
+
+ThreadCounters& threadCounters() {
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+std::mutex totals_mutex;
+std::map<std::string, PerfCounts> totals;
+
+// Adds the counts since resumed to the innermost phase.
+void charge(ThreadCounters& counters, const Reading& now) {
+    if (counters.phases.empty()) {
+        return;
+    }
+    const Reading& then = counters.resumed;
+    std::unique_lock<std::mutex> lock(totals_mutex);
+    PerfCounts& total = totals[counters.phases.back().first];
+    if (counters.phases.back().second) {
+        total.wall_seconds +=
+            std::chrono::duration<double>(now.wall - then.wall).count();
+    }
+    total.cpu_seconds += now.cpu_seconds - then.cpu_seconds;
+    total.cycles += now.events[0] - then.events[0];
+    total.instructions += now.events[1] - then.events[1];
+    total.cache_misses += now.events[2] - then.events[2];
+    total.dtlb_misses += now.events[3] - then.events[3];
+    total.branch_misses += now.events[4] - then.events[4];
+}
+
+}  // namespace
+
+void PerfCounters::enable() { enabled_.store(true); }
+
+bool PerfCounters::enableHardware() {
+    ThreadCounters& counters = threadCounters();
+    counters.openHardware();
+    if (!counters.hardwareOpen()) {
+        return false;
+    }
+    hardware_.store(true);
+    enabled_.store(true);
+    return true;
+}
+
+const char* PerfCounters::currentPhase() {
+    if (!enabled()) {
+        return nullptr;
+    }
+    ThreadCounters& counters = threadCounters();
+    return counters.phases.empty() ? nullptr : counters.phases.back().first;
+}
+
+std::map<std::string, PerfCounts> PerfCounters::phaseCounts() {
+    std::unique_lock<std::mutex> lock(totals_mutex);
+    return totals;
+}
+
+void PerfCounters::reset() {
+    std::unique_lock<std::mutex> lock(totals_mutex);
+    totals.clear();
+}
+
+void PerfCounters::enter(const char* phase, bool wall) {
+    ThreadCounters& counters = threadCounters();
+    if (hardware_.load(std::memory_order_relaxed)) {
+        counters.openHardware();
+    }
+    Reading now = counters.read();
+    charge(counters, now);
+    counters.phases.push_back({phase, wall});
+    counters.resumed = now;
+}
+
+void PerfCounters::leave() {
+    ThreadCounters& counters = threadCounters();
+    Reading now = counters.read();
+    charge(counters, now);
+    counters.phases.pop_back();
+    counters.resumed = now;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+
+struct PerfCounts {
+        // Wall time of the thread that entered the phase, and CPU time of
+        // every thread that ran in it.
+        double wall_seconds = 0;
+        double cpu_seconds = 0;
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t cache_misses = 0;
+        uint64_t dtlb_misses = 0;
+        uint64_t branch_misses = 0;
+};
+
+// Time and hardware counters per reduction phase. A phase sums the counts of
+// every thread that ran in it; chunks of a parallel phase count towards the
+// phase their caller is in. Hardware counters are read through
+// perf_event_open on Linux, from a counter group each thread opens the first
+// time it enters a phase.
+class PerfCounters {
+    public:
+        // Starts timing phases.
+        static void enable();
+
+        // Also starts hardware counting. Returns false, counting no events,
+        // if the counters cannot be opened, as outside Linux or under a
+        // strict perf_event_paranoid.
+        static bool enableHardware();
+
+        static bool enabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        // Innermost phase of the calling thread, or null if it is in none or
+        // counting is off.
+        static const char* currentPhase();
+
+        static std::map<std::string, PerfCounts> phaseCounts();
+
+        // Starts every phase over from zero. No thread may be in a phase.
+        static void reset();
+
+    private:
+        friend class PerfPhase;
+
+        static void enter(const char* phase, bool wall);
+
+        static void leave();
+
+        inline static std::atomic<bool> enabled_ = false;
+        inline static std::atomic<bool> hardware_ = false;
+};
+
+// Counts the calling thread under phase, a string that outlives the process,
+// for the lifetime of the scope. An enclosing phase of the same thread is
+// paused meanwhile. Without wall, only CPU time and events are counted, as
+// for a chunk that runs while its caller's phase is timed. Does nothing if
+// phase is null or counting is off.
+class PerfPhase {
+    public:
+        PerfPhase(const char* phase, bool wall = true)
+            : active_(phase && PerfCounters::enabled()) {
+            if (active_) {
+                PerfCounters::enter(phase, wall);
+            }
+        }
+
+        PerfPhase(const PerfPhase&) = delete;
+        PerfPhase& operator=(const PerfPhase&) = delete;
+
+        ~PerfPhase() {
+            if (active_) {
+                PerfCounters::leave();
+            }
+        }
+
+    private:
+        bool active_;
+};
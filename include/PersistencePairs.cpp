@@ -0,0 +1,44 @@
+#include "PersistencePairs.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <stdexcept>
+
+#include "PerfCounters.hpp"
+
+PairFileWriter::PairFileWriter(const std::string& file_path)
+    : file_(file_path) {
+    if (!file_.is_open()) {
+        throw std::runtime_error("Could not open file");
+    }
+    buffer_.reserve(block_size_);
+}
+
+PairFileWriter::~PairFileWriter() { flush(); }
+
+void PairFileWriter::addPair(uint64_t birth, uint64_t death) {
+    append(birth);
+    buffer_ += ' ';
+    append(death);
+    buffer_ += '\n';
+    if (buffer_.size() >= block_size_ - 64) {
+        flush();
+    }
+}
+
+void PairFileWriter::flush() {
+    PerfPhase perf("write");
+    auto start = std::chrono::steady_clock::now();
+    file_.write(buffer_.data(), buffer_.size());
+    file_.flush();
+    buffer_.clear();
+    write_seconds_ += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+}
+
+void PairFileWriter::append(uint64_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer_.append(digits, result.ptr);
+}
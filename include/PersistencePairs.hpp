@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Receives the (birth, death) pairs of a reduction in increasing death order,
+// each as soon as the column that dies is final.
+class PairSink {
+    public:
+        virtual ~PairSink() = default;
+
+        virtual void addPair(uint64_t birth, uint64_t death) = 0;
+};
+
+// Writes one "birth death" line per pair. Lines are formatted into a buffer
+// that goes to the file in blocks, each timed as the "write" phase.
+class PairFileWriter : public PairSink {
+    public:
+        PairFileWriter(const std::string& file_path);
+
+        ~PairFileWriter();
+
+        void addPair(uint64_t birth, uint64_t death) override;
+
+        // Writes out everything buffered so far.
+        void flush();
+
+        // Time spent writing blocks to the file so far.
+        double writeSeconds() const { return write_seconds_; }
+
+    private:
+        void append(uint64_t value);
+
+        std::ofstream file_;
+        std::string buffer_;
+        const size_t block_size_ = 1 << 20;
+        double write_seconds_ = 0;
+};
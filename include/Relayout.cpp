@@ -0,0 +1,177 @@
+#include "Relayout.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t scan_block_size = 16384;
+const size_t chunks_per_thread = 8;
+const size_t streaming_min_length = 64;
+
+std::vector<size_t> blockBounds(size_t n) {
+    std::vector<size_t> bounds;
+    for (size_t start = 0; start < n; start += scan_block_size) {
+        bounds.push_back(start);
+    }
+    bounds.push_back(n);
+    return bounds;
+}
+
+template <typename Body>
+void forChunks(ExecutionBackend* backend, const char* phase,
+               const std::vector<size_t>& bounds, Body&& body) {
+    if (backend != nullptr) {
+        backend->parallelFor(phase, bounds, body);
+        return;
+    }
+    for (size_t c = 0; c + 1 < bounds.size(); c++) {
+        body(bounds[c], bounds[c + 1]);
+    }
+}
+
+// Large columns are written with streaming stores: the destination is a fresh
+// array that will not be read again before the next round, so pulling its
+// lines into the cache first only costs bandwidth.
+template <typename Row>
+void copyColumn(const Row* src, size_t len, Row* dst) {
+#if defined(__SSE2__)
+    const size_t per_vector = sizeof(__m128i) / sizeof(Row);
+    if (len >= streaming_min_length) {
+        while (((uintptr_t)dst & 15) != 0) {
+            *dst++ = *src++;
+            len--;
+        }
+        for (; len >= per_vector;
+             len -= per_vector, src += per_vector, dst += per_vector) {
+            _mm_stream_si128((__m128i*)dst,
+                             _mm_loadu_si128((const __m128i*)src));
+        }
+    }
+#endif
+    std::memcpy(dst, src, len * sizeof(Row));
+}
+
+// Exclusive scan of new_capacity(i) over all columns into new_col_start.
+template <typename Offset, typename Capacity>
+size_t scanLayout(ExecutionBackend* backend, size_t n, Capacity&& new_capacity,
+                  Offset* new_col_start) {
+    std::vector<size_t> bounds = blockBounds(n);
+    std::vector<size_t> block_sums(bounds.size() - 1);
+    auto sum_blocks = [&](size_t start, size_t end) {
+        size_t sum = 0;
+        for (size_t i = start; i < end; i++) {
+            sum += new_capacity(i);
+        }
+        block_sums[start / scan_block_size] = sum;
+    };
+    forChunks(backend, "layout-scan", bounds, sum_blocks);
+
+    size_t total = 0;
+    for (size_t& sum : block_sums) {
+        size_t block_total = sum;
+        sum = total;
+        total += block_total;
+    }
+
+    auto fill_blocks = [&](size_t start, size_t end) {
+        size_t cur_col_start = block_sums[start / scan_block_size];
+        for (size_t i = start; i < end; i++) {
+            new_col_start[i] = cur_col_start;
+            cur_col_start += new_capacity(i);
+        }
+    };
+    forChunks(backend, "layout-scan", bounds, fill_blocks);
+    return total;
+}
+
+}  // namespace
+
+size_t computeWidenedLayout(ExecutionBackend* backend, size_t n,
+                            size_t row_index_size, const uint32_t* col_start,
+                            const uint32_t* col_end, const uint32_t* to_add,
+                            uint32_t* new_col_start) {
+    auto new_capacity = [&](size_t i) -> size_t {
+        int64_t len = col_end[i] - col_start[i];
+        if (len == 0) {
+            return 0;
+        }
+
+        size_t capacity =
+            (i + 1 != n ? col_start[i + 1] : row_index_size) - col_start[i];
+        if (to_add[i] != n) {
+            int64_t to_add_len = col_end[to_add[i]] - col_start[to_add[i]];
+            capacity += std::max(to_add_len - 2, len);
+        }
+        return capacity;
+    };
+    return scanLayout(backend, n, new_capacity, new_col_start);
+}
+
+template <typename Offset>
+size_t computePackedLayout(ExecutionBackend* backend, size_t n,
+                           const Offset* col_start, const Offset* col_end,
+                           const Offset* col_capacity, Offset* new_col_start) {
+    auto new_capacity = [&](size_t i) -> size_t {
+        return col_end[i] != col_start[i] ? col_capacity[i] : 0;
+    };
+    return scanLayout(backend, n, new_capacity, new_col_start);
+}
+
+template <typename Offset, typename Row>
+void relocateColumns(ExecutionBackend* backend, size_t n, const Row* row_index,
+                     Offset* col_start, Offset* col_end,
+                     const Offset* new_col_start, size_t new_size,
+                     Row* new_row_index) {
+    size_t chunk_count =
+        backend != nullptr ? backend->concurrency() * chunks_per_thread : 1;
+    std::vector<size_t> bounds = {0};
+    for (size_t c = 1; c < chunk_count; c++) {
+        size_t bound = std::upper_bound(new_col_start, new_col_start + n,
+                                        new_size * c / chunk_count) -
+                       new_col_start;
+        if (bound > bounds.back() && bound < n) {
+            bounds.push_back(bound);
+        }
+    }
+    bounds.push_back(n);
+
+    auto relocate = [&](size_t chunk_start, size_t chunk_end) {
+        for (size_t i = chunk_start; i < chunk_end; i++) {
+            Offset start = col_start[i];
+            Offset end = col_end[i];
+            Offset new_start = new_col_start[i];
+
+            copyColumn(row_index + start, end - start,
+                       new_row_index + new_start);
+
+            col_start[i] = new_start;
+            col_end[i] = new_start + (end - start);
+        }
+#if defined(__SSE2__)
+        _mm_sfence();
+#endif
+    };
+    forChunks(backend, "relocate", bounds, relocate);
+}
+
+template size_t computePackedLayout(ExecutionBackend*, size_t,
+                                    const uint32_t*, const uint32_t*,
+                                    const uint32_t*, uint32_t*);
+template size_t computePackedLayout(ExecutionBackend*, size_t,
+                                    const uint64_t*, const uint64_t*,
+                                    const uint64_t*, uint64_t*);
+template void relocateColumns(ExecutionBackend*, size_t, const uint32_t*,
+                              uint32_t*, uint32_t*, const uint32_t*, size_t,
+                              uint32_t*);
+template void relocateColumns(ExecutionBackend*, size_t, const uint32_t*,
+                              uint64_t*, uint64_t*, const uint64_t*, size_t,
+                              uint32_t*);
+template void relocateColumns(ExecutionBackend*, size_t, const uint64_t*,
+                              uint64_t*, uint64_t*, const uint64_t*, size_t,
+                              uint64_t*);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ExecutionBackend.hpp"
+
+// Fills new_col_start with a layout in which every non-empty column keeps its
+// current capacity and gains enough room to add its to_add partner once.
+// Returns the size of the new row index array, which the caller must check
+// against the 32-bit offsets before using new_col_start. backend may be
+// null, in which case everything runs on the calling thread.
+size_t computeWidenedLayout(ExecutionBackend* backend, size_t n,
+                            size_t row_index_size, const uint32_t* col_start,
+                            const uint32_t* col_end, const uint32_t* to_add,
+                            uint32_t* new_col_start);
+
+// Fills new_col_start with a packed layout in which every non-empty column
+// keeps col_capacity entries and empty columns get none. Returns the size of
+// the new row index array. Instantiated for 32- and 64-bit offsets.
+template <typename Offset>
+size_t computePackedLayout(ExecutionBackend* backend, size_t n,
+                           const Offset* col_start, const Offset* col_end,
+                           const Offset* col_capacity, Offset* new_col_start);
+
+// Copies every column into new_row_index at new_col_start and moves col_start
+// and col_end along with it. Instantiated for the offset and row types of
+// the column arena.
+template <typename Offset, typename Row>
+void relocateColumns(ExecutionBackend* backend, size_t n, const Row* row_index,
+                     Offset* col_start, Offset* col_end,
+                     const Offset* new_col_start, size_t new_size,
+                     Row* new_row_index);
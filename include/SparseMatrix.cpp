@@ -1,102 +1,95 @@
 #include "SparseMatrix.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
-SparseMatrix::SparseMatrix(const std::string& file_path)
-    : SparseMatrixBase(file_path) {}
+#include "PerfCounters.hpp"
 
-void SparseMatrix::widenBuffer(std::vector<uint32_t>& row_index_buffer,
-                               const std::vector<uint32_t>& to_add) {
-    std::vector<uint32_t> new_col_start(n_);
+template <typename Offset, typename Row>
+SparseMatrix<Offset, Row>::SparseMatrix(const std::string& file_path,
+                                        const ArenaOptions& options)
+    : Base(file_path, options) {}
 
-    uint32_t cur_col_start = 0;
-    for (size_t i = 0; i < n_; i++) {
-        new_col_start[i] = cur_col_start;
+template <typename Offset, typename Row>
+SparseMatrix<Offset, Row>::SparseMatrix(std::istream& input,
+                                        const ArenaOptions& options)
+    : Base(input, options) {}
 
-        uint32_t len = col_end_[i] - col_start_[i];
-        uint32_t cur_to_add = to_add[i];
-        if (len != 0) {
-            cur_col_start += (i + 1 != n_ ? col_start_[i + 1]
-                                          : (uint32_t)row_index_.size()) -
-                             col_start_[i];
+template <typename Offset, typename Row>
+SparseMatrix<Offset, Row>::SparseMatrix(size_t n,
+                                        DefaultInitVector<Offset> col_ptr,
+                                        DefaultInitVector<Row> row_index,
+                                        const ArenaOptions& options)
+    : Base(n, std::move(col_ptr), std::move(row_index), options) {}
 
-            if (cur_to_add != n_) {
-                uint32_t to_add_len =
-                    col_end_[cur_to_add] - col_start_[cur_to_add];
-                cur_col_start += std::max((int)to_add_len - 2, (int)len);
-            }
-        }
-    }
-
-    uint32_t new_size = cur_col_start;
-
-    row_index_buffer.resize(new_size, 0);
-
-    for (size_t i = 0; i < n_; i++) {
-        int start = col_start_[i];
-        int end = col_end_[i];
-        int new_start = new_col_start[i];
-
-        std::copy(row_index_.begin() + start, row_index_.begin() + end,
-                  row_index_buffer.begin() + new_start);
-
-        col_start_[i] = new_start;
-        col_end_[i] = new_start + (end - start);
-    }
-
-    row_index_.resize(new_size, 0);
-    std::swap(row_index_, row_index_buffer);
-}
-
-std::vector<uint32_t> SparseMatrix::reduce(bool run_twist) {
+template <typename Offset, typename Row>
+void SparseMatrix<Offset, Row>::reduce(PairSink& pairs, bool run_twist) {
+    startProfile();
     if (run_twist) {
         runTwist();
     }
 
-    bool need_widen_buffer = false;
-    std::vector<uint32_t> row_index_buffer(row_index_.size(), 0);
-    std::vector<uint32_t> to_add(n_, n_);
-    std::vector<uint32_t> inverse_low;
+    // The rows move to spill memory if the budget cannot also take these.
+    auto to_add = allocateRelieving(nullptr, [&] {
+        return DefaultInitVector<Row>(n_, n_, memory_.get());
+    });
+    auto inverse_low = allocateRelieving(nullptr, [&] {
+        return DefaultInitVector<Row>(n_, n_, memory_.get());
+    });
+    PH_TELEMETRY_ONLY(RoundTelemetry round; round.engine = "sparse";)
     while (true) {
-        bool is_over = true;
+        PH_TELEMETRY_ONLY(RoundClock clock(round);)
+        size_t first_pending = n_;
         inverse_low.assign(n_, n_);
-        for (uint32_t i = 0; i < n_; i++) {
-            uint32_t cur_low = getLow(i);
-            if (cur_low == n_) {
-                continue;
-            }
-            uint32_t cur_inverse_low = inverse_low[cur_low];
-
-            if (cur_inverse_low == n_) {
-                inverse_low[cur_low] = i;
-            } else {
-                to_add[i] = cur_inverse_low;
-            }
-            if (to_add[i] != n_) {
-                is_over = false;
-            }
-
-            if (!enoughSizeForIteration(i, to_add[i])) {
-                need_widen_buffer = true;
+        {
+            PerfPhase perf("pivot");
+            for (size_t i = 0; i < n_; i++) {
+                Row cur_low = getLow(i);
+                if (cur_low == n_) {
+                    continue;
+                }
+                Row cur_inverse_low = inverse_low[cur_low];
+
+                if (cur_inverse_low == n_) {
+                    inverse_low[cur_low] = i;
+                } else {
+                    to_add[i] = cur_inverse_low;
+                }
+                if (to_add[i] != n_ && first_pending == n_) {
+                    first_pending = i;
+                }
             }
         }
-        if (is_over) {
+        finalizeColumns(first_pending, pairs);
+        PH_TELEMETRY_ONLY(clock.lap("pivot");)
+        if (first_pending == n_) {
+            PH_TELEMETRY_ONLY(recordRound(round);)
             break;
         }
 
-        if (need_widen_buffer) {
-            widenBuffer(row_index_buffer, to_add);
-            need_widen_buffer = false;
+        {
+            PerfPhase perf("widen");
+            columns_.compactIfFragmented(nullptr, max_arena_waste_);
         }
-
+        PH_TELEMETRY_ONLY(clock.lap("compact");)
+        PerfPhase perf("add");
+        auto workspace = columns_.borrowWorkspace();
         for (size_t i = 0; i < n_; i++) {
+            if (i % paging_window_ == 0) {
+                columns_.advise(i, std::min(i + paging_window_, n_),
+                                MemoryAdvice::WillNeed);
+            }
             if (to_add[i] != n_) {
-                addColumn(i, to_add[i], row_index_buffer);
+                addColumnGrowing(i, to_add[i], workspace, nullptr);
                 to_add[i] = n_;
+                PH_TELEMETRY_ONLY(round.active_columns++;)
             }
         }
+        PH_TELEMETRY_ONLY(clock.lap("add"); recordRound(round);)
     }
-
-    return getLowArray();
 }
+
+template class SparseMatrix<uint32_t, uint32_t>;
+template class SparseMatrix<uint64_t, uint32_t>;
+template class SparseMatrix<uint64_t, uint64_t>;
@@ -5,13 +5,41 @@
 
 #include "SparseMatrixBase.hpp"
 
-class SparseMatrix : public SparseMatrixBase {
+template <typename Offset = uint32_t, typename Row = uint32_t>
+class SparseMatrix : public SparseMatrixBase<Offset, Row> {
     public:
-        SparseMatrix(const std::string& file_path);
+        SparseMatrix(const std::string& file_path,
+                     const ArenaOptions& options = {});
 
-        std::vector<uint32_t> reduce(bool run_twist = true) override;
+        SparseMatrix(std::istream& input, const ArenaOptions& options = {});
+
+        // In-memory columns; see SparseMatrixBase.
+        SparseMatrix(size_t n, DefaultInitVector<Offset> col_ptr,
+                     DefaultInitVector<Row> row_index,
+                     const ArenaOptions& options = {});
+
+        template <typename Ptr, typename Index>
+        SparseMatrix(const CscSpan<Ptr, Index>& csc,
+                     const ArenaOptions& options = {})
+            : Base(csc, options) {}
+
+        void reduce(PairSink& pairs, bool run_twist = true) override;
 
     private:
-        void widenBuffer(std::vector<uint32_t>& row_index_buffer,
-                         const std::vector<uint32_t>& to_add);
+        using Base = SparseMatrixBase<Offset, Row>;
+        using Base::addColumnGrowing;
+        using Base::allocateRelieving;
+        using Base::columns_;
+        using Base::getLow;
+        using Base::finalizeColumns;
+        using Base::max_arena_waste_;
+        using Base::memory_;
+        using Base::n_;
+        using Base::runTwist;
+        using Base::startProfile;
+        PH_TELEMETRY_ONLY(using Base::recordRound;)
+
+        // A spilled row index array is paged in ahead of the add pass in
+        // windows of this many columns.
+        const size_t paging_window_ = 1 << 16;
 };
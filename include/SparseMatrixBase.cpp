@@ -1,24 +1,95 @@
 #include "SparseMatrixBase.hpp"
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
-SparseMatrixBase::SparseMatrixBase(const std::string& file_path) {
-    readFromFile(file_path);
+#include "PerfCounters.hpp"
+
+namespace {
+
+// The row index array may grow to this many times the estimated nnz before
+// offsets have to be 64-bit.
+const uint64_t offset_headroom = 4;
+
+}  // namespace
+
+template <typename Offset, typename Row>
+SparseMatrixBase<Offset, Row>::SparseMatrixBase(const std::string& file_path,
+                                                const ArenaOptions& options)
+    : memory_(options.memory), spill_memory_(options.spill_memory) {
+    readFromFile(file_path, options);
 }
 
-size_t SparseMatrixBase::size() const { return n_; }
+template <typename Offset, typename Row>
+SparseMatrixBase<Offset, Row>::SparseMatrixBase(std::istream& input,
+                                                const ArenaOptions& options)
+    : memory_(options.memory), spill_memory_(options.spill_memory) {
+    read(input, 0, options);
+}
+
+template <typename Offset, typename Row>
+SparseMatrixBase<Offset, Row>::SparseMatrixBase(
+    size_t n, DefaultInitVector<Offset> col_ptr,
+    DefaultInitVector<Row> row_index, const ArenaOptions& options)
+    : memory_(options.memory), spill_memory_(options.spill_memory) {
+    PerfPhase perf("parse");
+    assignColumns(n, std::move(col_ptr), std::move(row_index), options);
+}
+
+template <typename Offset, typename Row>
+size_t SparseMatrixBase<Offset, Row>::size() const {
+    return n_;
+}
+
+template <typename Offset, typename Row>
+size_t SparseMatrixBase<Offset, Row>::rowIndexBytes() const {
+    return columns_.rowCapacity() * sizeof(Row);
+}
+
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::readFromFile(const std::string& file_path,
+                                                 const ArenaOptions& options) {
+    uint64_t header_n = 0;
+    uint64_t estimated_nnz = estimateNnz(file_path, header_n);
 
-void SparseMatrixBase::readFromFile(const std::string& file_path) {
     std::ifstream file(file_path);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file");
     }
+    read(file, estimated_nnz, options);
+}
 
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::read(std::istream& input,
+                                         uint64_t estimated_nnz,
+                                         const ArenaOptions& options) {
+    PerfPhase perf("parse");
+    DefaultInitVector<Row> row_index;
+    // Moves the rows to spill memory once the budget cannot take them.
+    auto push_row = [&](Row index) {
+        if (row_index.size() == row_index.capacity() && spill_memory_ &&
+            row_index.get_allocator().resource() != spill_memory_.get()) {
+            size_t capacity = std::max<size_t>(2 * row_index.size(), 16);
+            try {
+                row_index.reserve(capacity);
+            } catch (const MemoryBudgetExceeded&) {
+                DefaultInitVector<Row> spilled(spill_memory_.get());
+                spilled.reserve(capacity);
+                spilled.assign(row_index.begin(), row_index.end());
+                row_index = std::move(spilled);
+            }
+        }
+        row_index.push_back(index);
+    };
+    DefaultInitVector<Offset> col_start(memory_.get());
+    DefaultInitVector<Offset> col_end(memory_.get());
     std::string line;
     size_t i = 0;
-    while (std::getline(file, line)) {
+    while (std::getline(input, line)) {
         if (i > n_) {
             if (!line.empty()) {
                 throw std::runtime_error("File too long");
@@ -29,113 +100,237 @@ void SparseMatrixBase::readFromFile(const std::string& file_path) {
         std::istringstream iss(line);
         if (i == 0) {
             iss >> n_;
-            col_start_.resize(n_, 0);
-            col_end_.resize(n_, 0);
+            row_index = DefaultInitVector<Row>(rowMemoryFor(n_, estimated_nnz));
+            row_index.reserve(estimated_nnz);
+            col_start.resize(n_, 0);
+            col_end.resize(n_, 0);
         } else {
-            uint32_t count = 0;
-            uint32_t index;
+            Row index;
             while (iss >> index) {
-                count++;
-                row_index_.push_back(index);
+                push_row(index);
             }
 
+            // The estimate that picked Offset may have been too low.
+            if (row_index.size() > std::numeric_limits<Offset>::max()) {
+                throw OffsetOverflow("Too many entries for the offset type");
+            }
+            Offset end = row_index.size();
             if (i < n_) {
-                col_start_[i] = col_start_[i - 1] + count;
-                col_end_[i - 1] = col_start_[i];
+                col_start[i] = end;
+                col_end[i - 1] = end;
             } else {
-                col_end_[n_ - 1] = col_start_[n_ - 1] + count;
+                col_end[n_ - 1] = end;
             }
         }
         i++;
     }
-}
 
-uint32_t SparseMatrixBase::getLow(uint32_t col_index) const {
-    return col_start_[col_index] == col_end_[col_index]
-               ? n_
-               : row_index_[col_end_[col_index] - 1];
+    columns_.assign(std::move(row_index), std::move(col_start),
+                    std::move(col_end), options.encoding);
 }
 
-bool SparseMatrixBase::enoughSizeForIteration(uint32_t col,
-                                              uint32_t to_add) const {
-    uint32_t len = col_end_[col] - col_start_[col];
-    if (len == 0 || to_add == n_) {
-        return true;
+template <typename Offset, typename Row>
+MemoryResource* SparseMatrixBase<Offset, Row>::rowMemoryFor(
+    uint64_t n, uint64_t nnz) const {
+    // Start, end and capacity offsets and the window base of each column.
+    uint64_t column_bytes = n * (3 * sizeof(Offset) + sizeof(Row));
+    if (spill_memory_ &&
+        (!memory_ || memory_->limit() == 0 ||
+         !memory_->fits(nnz * sizeof(Row) + column_bytes))) {
+        return spill_memory_.get();
     }
+    return memory_.get();
+}
 
-    uint32_t available_size;
-    if (col + 1 < n_) {
-        available_size = col_start_[col + 1] - col_start_[col];
-    } else {
-        available_size = row_index_.size() - col_start_[col];
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::assignColumns(
+    size_t n, DefaultInitVector<Offset> col_ptr,
+    DefaultInitVector<Row> row_index, const ArenaOptions& options) {
+    if (n >= std::numeric_limits<Row>::max() || col_ptr.size() != n + 1 ||
+        col_ptr[0] != 0 || col_ptr[n] != row_index.size()) {
+        throw std::runtime_error("Column pointers do not match the rows");
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (col_ptr[i] > col_ptr[i + 1]) {
+            throw std::runtime_error("Column pointers are decreasing");
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = col_ptr[i]; k < col_ptr[i + 1]; k++) {
+            if (row_index[k] >= n ||
+                (k > col_ptr[i] && row_index[k] <= row_index[k - 1])) {
+                throw std::runtime_error("Column rows are out of order");
+            }
+        }
     }
 
-    uint32_t to_add_len = col_end_[to_add] - col_start_[to_add];
-    return len + std::max(to_add_len - 2, len) <= available_size;
+    n_ = n;
+    DefaultInitVector<Offset> col_end(col_ptr.begin() + 1, col_ptr.end(),
+                                      col_ptr.get_allocator());
+    col_ptr.pop_back();
+    columns_.assign(std::move(row_index), std::move(col_ptr),
+                    std::move(col_end), options.encoding);
 }
 
-void SparseMatrixBase::addColumn(uint32_t add_to, uint32_t add_from,
-                                 std::vector<uint32_t>& row_index_buffer) {
-    uint32_t end1 = col_end_[add_to];
-    uint32_t end2 = col_end_[add_from];
+template <typename Offset, typename Row>
+Row SparseMatrixBase<Offset, Row>::getLow(size_t col_index) const {
+    return columns_.low(col_index);
+}
 
-    uint32_t i = col_start_[add_to];
-    uint32_t j = col_start_[add_from];
-    uint32_t k = col_start_[add_to];
-    while (i < end1 && j < end2) {
-        if (row_index_[i] < row_index_[j]) {
-            row_index_buffer[k] = row_index_[i];
-            i++;
-            k++;
-        } else if (row_index_[i] > row_index_[j]) {
-            row_index_buffer[k] = row_index_[j];
-            j++;
-            k++;
-        } else {
-            i++;
-            j++;
-        }
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::startProfile() {
+    if (!profile_) {
+        return;
     }
-    while (i < end1) {
-        row_index_buffer[k] = row_index_[i];
-        i++;
-        k++;
+    profile_->start(n_);
+    for (size_t i = 0; i < n_; i++) {
+        profile_->setInitial(i, columns_.length(i), getLow(i));
+    }
+}
+
+template <typename Offset, typename Row>
+bool SparseMatrixBase<Offset, Row>::addColumn(
+    size_t add_to, size_t add_from,
+    typename ColumnArena<Offset, Row>::Workspace& workspace) {
+    if (!profile_) {
+        return columns_.addColumn(add_to, add_from, workspace);
     }
-    while (j < end2) {
-        row_index_buffer[k] = row_index_[j];
-        j++;
-        k++;
+    auto begin = ColumnProfile::Clock::now();
+    if (!columns_.addColumn(add_to, add_from, workspace)) {
+        return false;
     }
+    profile_->addition(add_to, columns_.length(add_to), begin);
+    return true;
+}
 
-    uint32_t available_size;
-    if (add_to + 1 < n_) {
-        available_size = col_start_[add_to + 1] - col_start_[add_to];
-    } else {
-        available_size = row_index_.size() - col_start_[add_to];
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::finalizeColumns(size_t end,
+                                                    PairSink& pairs) {
+    PerfPhase perf("output");
+    auto workspace = columns_.borrowWorkspace();
+    for (; finalized_ < end; finalized_++) {
+        Row low = getLow(finalized_);
+        if (profile_) {
+            profile_->setFinal(finalized_, columns_.length(finalized_));
+        }
+        if (low != n_) {
+            pairs.addPair(low, finalized_);
+        } else {
+            columns_.discard(finalized_, *workspace);
+        }
     }
-    if (k - col_start_[add_to] > available_size) {
-        throw std::runtime_error("Not enough space");
+}
+
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::growColumns(ExecutionBackend* backend,
+                                                size_t words) {
+    PerfPhase perf("widen");
+    while (true) {
+        try {
+            columns_.reserve(words);
+            return;
+        } catch (const MemoryBudgetExceeded&) {
+            if (!relieveMemoryPressure(backend)) {
+                throw;
+            }
+        }
     }
+}
 
-    for (uint32_t i = col_start_[add_to]; i < k; i++) {
-        row_index_[i] = row_index_buffer[i];
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::addColumnGrowing(
+    size_t add_to, size_t add_from,
+    typename ColumnArena<Offset, Row>::WorkspaceHandle& workspace,
+    ExecutionBackend* backend) {
+    if (addColumn(add_to, add_from, *workspace)) {
+        return;
+    }
+    workspace.reset();
+    growColumns(backend, columns_.blockSize(columns_.length(add_to) +
+                                            columns_.length(add_from)));
+    workspace = columns_.borrowWorkspace();
+    if (!addColumn(add_to, add_from, *workspace)) {
+        throw std::runtime_error("Column arena exhausted");
     }
-    col_end_[add_to] = k;
 }
 
-std::vector<uint32_t> SparseMatrixBase::getLowArray() const {
-    std::vector<uint32_t> lowArray(n_);
-    for (uint32_t i = 0; i < n_; i++) {
-        lowArray[i] = getLow(i);
+template <typename Offset, typename Row>
+bool SparseMatrixBase<Offset, Row>::relieveMemoryPressure(
+    ExecutionBackend* backend) {
+    if (columns_.compactIfFragmented(backend, 0)) {
+        return true;
     }
-    return lowArray;
+    if (spill_memory_ && columns_.rowMemory() != spill_memory_.get()) {
+        columns_.moveRows(spill_memory_.get());
+        return true;
+    }
+    return false;
 }
 
-void SparseMatrixBase::runTwist() {
-    for (uint32_t i = 0; i < n_; i++) {
-        uint32_t curLow = getLow(i);
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::runTwist() {
+    PerfPhase perf("twist");
+    for (size_t i = 0; i < n_; i++) {
+        Row curLow = getLow(i);
         if (curLow != n_) {
-            col_end_[curLow] = col_start_[curLow];
+            columns_.clear(curLow);
+        }
+    }
+}
+
+#ifdef PH_TELEMETRY
+template <typename Offset, typename Row>
+void SparseMatrixBase<Offset, Row>::recordRound(RoundTelemetry& round) {
+    auto stats = columns_.takeStats();
+    if (telemetry_) {
+        round.additions = stats.additions;
+        round.entries_merged = stats.entries_merged;
+        round.entries_cancelled = stats.entries_cancelled;
+        round.widen_events = stats.widen_events;
+        round.bytes_copied = stats.bytes_copied;
+        for (size_t i = 0; i < n_; i++) {
+            round.max_column_length =
+                std::max<uint64_t>(round.max_column_length, columns_.length(i));
         }
+        telemetry_->addRound(round);
     }
+
+    RoundTelemetry next;
+    next.engine = round.engine;
+    next.round = round.round + 1;
+    round = next;
+}
+#endif
+
+template class SparseMatrixBase<uint32_t, uint32_t>;
+template class SparseMatrixBase<uint64_t, uint32_t>;
+template class SparseMatrixBase<uint64_t, uint64_t>;
+
+uint64_t estimateNnz(const std::string& file_path, uint64_t& n) {
+    std::ifstream file(file_path);
+    if (!file.is_open() || !(file >> n)) {
+        throw std::runtime_error("Could not read " + file_path);
+    }
+
+    uint64_t digits = 1;
+    for (uint64_t rest = n; rest >= 10; rest /= 10) {
+        digits++;
+    }
+    uint64_t file_size = std::filesystem::file_size(file_path);
+    return file_size > n ? (file_size - n) / (digits + 1) : 0;
+}
+
+IndexWidths chooseIndexWidths(const std::string& file_path) {
+    uint64_t n = 0;
+    uint64_t nnz = estimateNnz(file_path, n);
+    return chooseIndexWidths(n, nnz);
+}
+
+IndexWidths chooseIndexWidths(uint64_t n, uint64_t nnz) {
+    uint64_t max_narrow = std::numeric_limits<uint32_t>::max();
+    IndexWidths widths;
+    widths.wide_rows = n >= max_narrow;
+    widths.wide_offsets =
+        widths.wide_rows || nnz * offset_headroom >= max_narrow;
+    return widths;
 }
@@ -1,33 +1,234 @@
 #pragma once
 
+#include <istream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "ColumnArena.hpp"
 #include "IMatrix.hpp"
+#include "PerfCounters.hpp"
 
+// Thrown while loading a matrix with more entries than Offset can index.
+class OffsetOverflow : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+// Borrowed compressed sparse column arrays. Column i holds the rows
+// row_index[col_ptr[i]] to row_index[col_ptr[i + 1] - 1], in increasing
+// order; col_ptr has n + 1 entries and starts at 0.
+template <typename Ptr, typename Index>
+struct CscSpan {
+        size_t n;
+        const Ptr* col_ptr;
+        const Index* row_index;
+
+        size_t nnz() const { return col_ptr[n]; }
+};
+
+// Offset indexes the row index array and Row holds a row or column index; see
+// makeMatrix for how they are picked.
+template <typename Offset = uint32_t, typename Row = uint32_t>
 class SparseMatrixBase : public IMatrix {
     public:
-        SparseMatrixBase(const std::string& file_path);
+        SparseMatrixBase(const std::string& file_path,
+                         const ArenaOptions& options);
+
+        // Parses a matrix in the file format from input.
+        SparseMatrixBase(std::istream& input, const ArenaOptions& options);
+
+        // Takes over col_ptr and row_index, laid out as in CscSpan, without
+        // copying the rows. They stay outside options.memory.
+        SparseMatrixBase(size_t n, DefaultInitVector<Offset> col_ptr,
+                         DefaultInitVector<Row> row_index,
+                         const ArenaOptions& options);
+
+        // Copies the columns of csc, which is not used afterwards.
+        template <typename Ptr, typename Index>
+        SparseMatrixBase(const CscSpan<Ptr, Index>& csc,
+                         const ArenaOptions& options)
+            : memory_(options.memory), spill_memory_(options.spill_memory) {
+            PerfPhase perf("parse");
+            if (csc.n >= std::numeric_limits<Row>::max() ||
+                csc.nnz() > std::numeric_limits<Offset>::max()) {
+                throw std::runtime_error(
+                    "Matrix too large for its index types");
+            }
+            DefaultInitVector<Offset> col_ptr(
+                csc.col_ptr, csc.col_ptr + csc.n + 1, memory_.get());
+            DefaultInitVector<Row> row_index(csc.row_index,
+                                             csc.row_index + csc.nnz(),
+                                             rowMemoryFor(csc.n, csc.nnz()));
+            assignColumns(csc.n, std::move(col_ptr), std::move(row_index),
+                          options);
+        }
 
         size_t size() const override;
 
+        size_t rowIndexBytes() const override;
+
     protected:
-        void readFromFile(const std::string& file_path);
+        void readFromFile(const std::string& file_path,
+                          const ArenaOptions& options);
+
+        // estimated_nnz, if not 0, sizes the row index array up front.
+        void read(std::istream& input, uint64_t estimated_nnz,
+                  const ArenaOptions& options);
 
-        uint32_t getLow(uint32_t col_index) const;
+        // Memory for the row index array of n columns with nnz entries:
+        // spill memory if there is no budget or it cannot hold them along
+        // with the column offsets, else the budget.
+        MemoryResource* rowMemoryFor(uint64_t n, uint64_t nnz) const;
 
-        bool enoughSizeForIteration(uint32_t col, uint32_t to_add) const;
+        // Checks col_ptr and row_index, laid out as in CscSpan, and hands
+        // them to the arena.
+        void assignColumns(size_t n, DefaultInitVector<Offset> col_ptr,
+                           DefaultInitVector<Row> row_index,
+                           const ArenaOptions& options);
 
-        void addColumn(uint32_t col1, uint32_t col2,
-                       std::vector<uint32_t>& row_index_buffer);
+        Row getLow(size_t col_index) const;
+
+        // Starts profile_, if set, from the input columns. Must run before
+        // runTwist.
+        void startProfile();
+
+        // Adds column add_from to column add_to like ColumnArena::addColumn,
+        // counting the addition in profile_ if it succeeds.
+        bool addColumn(size_t add_to, size_t add_from,
+                       typename ColumnArena<Offset, Row>::Workspace& workspace);
 
         void runTwist();
 
-        std::vector<uint32_t> getLowArray() const;
+        // Passes the pairs of columns [finalized_, end) to pairs and gives
+        // the blocks of the zero ones back to the arena. No addition may
+        // change these columns again.
+        void finalizeColumns(size_t end, PairSink& pairs);
+
+        // Grows the arena by words. If the memory budget is in the way, the
+        // arena is compacted and then moved to spill memory, as far as that
+        // helps, before MemoryBudgetExceeded is thrown.
+        void growColumns(ExecutionBackend* backend, size_t words);
+
+        // Adds column add_from to column add_to, growing the arena if it is
+        // full. workspace is handed back while the arena grows. Throws if
+        // the sum does not fit even then.
+        void addColumnGrowing(
+            size_t add_to, size_t add_from,
+            typename ColumnArena<Offset, Row>::WorkspaceHandle& workspace,
+            ExecutionBackend* backend);
+
+        // Frees budgeted memory by compacting the arena, or else by moving
+        // its rows to spill memory. Returns false if neither is possible.
+        bool relieveMemoryPressure(ExecutionBackend* backend);
+
+        // Returns allocate(), which takes memory from the budget. If that
+        // does not fit, memory is relieved as far as that helps before
+        // MemoryBudgetExceeded is thrown.
+        template <typename Allocate>
+        auto allocateRelieving(ExecutionBackend* backend,
+                               Allocate&& allocate) {
+            while (true) {
+                try {
+                    return allocate();
+                } catch (const MemoryBudgetExceeded&) {
+                    if (!relieveMemoryPressure(backend)) {
+                        throw;
+                    }
+                }
+            }
+        }
+
+#ifdef PH_TELEMETRY
+        // Completes round with the statistics of the arena and the longest
+        // column, passes it to telemetry_ and starts the next round. No
+        // other thread may be using the arena.
+        void recordRound(RoundTelemetry& round);
+#endif
 
         size_t n_;
-        std::vector<uint32_t> row_index_;
-        std::vector<uint32_t> col_start_;
-        std::vector<uint32_t> col_end_;
-        const uint32_t widen_coef_ = 2;
+        // Columns before this one are final and have passed on their pairs.
+        size_t finalized_ = 0;
+        // Kept alive for as long as columns_ uses them.
+        std::shared_ptr<MemoryBudget> memory_;
+        std::shared_ptr<MemoryResource> spill_memory_;
+        ColumnArena<Offset, Row> columns_;
+        // The arena is compacted once more than this share of it is waste.
+        const double max_arena_waste_ = 0.5;
+};
+
+// Estimates n and nnz from the header line and the file size, without
+// parsing the columns.
+uint64_t estimateNnz(const std::string& file_path, uint64_t& n);
+
+struct IndexWidths {
+        bool wide_offsets;
+        bool wide_rows;
 };
+
+// 64-bit rows once n no longer fits 32 bits, and 64-bit offsets once the row
+// index array could outgrow 32 bits during the reduction.
+IndexWidths chooseIndexWidths(const std::string& file_path);
+
+IndexWidths chooseIndexWidths(uint64_t n, uint64_t nnz);
+
+// Constructs Matrix<Offset, Row> from args with the index types that widths
+// asks for.
+template <template <typename, typename> class Matrix, typename... Args>
+std::unique_ptr<IMatrix> makeMatrix(const IndexWidths& widths,
+                                    Args&&... args) {
+    if (widths.wide_rows) {
+        return std::make_unique<Matrix<uint64_t, uint64_t>>(
+            std::forward<Args>(args)...);
+    }
+    if (widths.wide_offsets) {
+        return std::make_unique<Matrix<uint64_t, uint32_t>>(
+            std::forward<Args>(args)...);
+    }
+    return std::make_unique<Matrix<uint32_t, uint32_t>>(
+        std::forward<Args>(args)...);
+}
+
+// Loads file_path into Matrix<Offset, Row> with the narrowest index types
+// that chooseIndexWidths allows, so small matrices keep 32-bit offsets. If
+// the file holds more entries than estimated and 32-bit offsets overflow, it
+// is loaded again with 64-bit ones.
+template <template <typename, typename> class Matrix, typename... Args>
+std::unique_ptr<IMatrix> makeMatrix(const std::string& file_path,
+                                    Args&&... args) {
+    IndexWidths widths = chooseIndexWidths(file_path);
+    try {
+        return makeMatrix<Matrix>(widths, file_path, args...);
+    } catch (const OffsetOverflow&) {
+        if (widths.wide_offsets) {
+            throw;
+        }
+    }
+    widths.wide_offsets = true;
+    return makeMatrix<Matrix>(widths, file_path, std::forward<Args>(args)...);
+}
+
+// Copies csc into Matrix<Offset, Row> with the narrowest index types that
+// chooseIndexWidths allows.
+template <template <typename, typename> class Matrix, typename Ptr,
+          typename Index, typename... Args>
+std::unique_ptr<IMatrix> makeMatrix(const CscSpan<Ptr, Index>& csc,
+                                    Args&&... args) {
+    return makeMatrix<Matrix>(chooseIndexWidths(csc.n, csc.nnz()), csc,
+                              std::forward<Args>(args)...);
+}
+
+// Moves col_ptr and row_index into Matrix<Offset, Row>, so the arrays pick
+// the index types; they must be one of the instantiated pairs.
+template <template <typename, typename> class Matrix, typename Offset,
+          typename Row, typename... Args>
+std::unique_ptr<IMatrix> makeMatrix(size_t n,
+                                    DefaultInitVector<Offset>&& col_ptr,
+                                    DefaultInitVector<Row>&& row_index,
+                                    Args&&... args) {
+    return std::make_unique<Matrix<Offset, Row>>(
+        n, std::move(col_ptr), std::move(row_index),
+        std::forward<Args>(args)...);
+}
@@ -0,0 +1,48 @@
+#include "TbbBackend.hpp"
+
+#include <functional>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+
+TbbBackend::TbbBackend(size_t num_threads)
+    : num_threads_(num_threads), arena_(num_threads) {}
+
+std::string TbbBackend::name() const { return "tbb"; }
+
+size_t TbbBackend::concurrency() const { return num_threads_; }
+
+void TbbBackend::runChunks(const std::vector<size_t>& bounds, ChunkBody body) {
+    if (bounds.size() < 2) {
+        return;
+    }
+
+    arena_.execute([&] {
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, bounds.size() - 1, 1),
+            [&](const tbb::blocked_range<size_t>& range) {
+                for (size_t c = range.begin(); c != range.end(); c++) {
+                    body(bounds[c], bounds[c + 1]);
+                }
+            });
+    });
+}
+
+uint64_t TbbBackend::sumChunks(const std::vector<size_t>& bounds,
+                               ChunkSum body) {
+    if (bounds.size() < 2) {
+        return 0;
+    }
+
+    return arena_.execute([&] {
+        return tbb::parallel_reduce(
+            tbb::blocked_range<size_t>(0, bounds.size() - 1, 1), uint64_t(0),
+            [&](const tbb::blocked_range<size_t>& range, uint64_t sum) {
+                for (size_t c = range.begin(); c != range.end(); c++) {
+                    sum += body(bounds[c], bounds[c + 1]);
+                }
+                return sum;
+            },
+            std::plus<uint64_t>());
+    });
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <tbb/task_arena.h>
+
+#include "ExecutionBackend.hpp"
+
+class TbbBackend : public ExecutionBackend {
+    public:
+        TbbBackend(size_t num_threads);
+
+        std::string name() const override;
+
+        size_t concurrency() const override;
+
+    protected:
+        void runChunks(const std::vector<size_t>& bounds,
+                       ChunkBody body) override;
+
+        uint64_t sumChunks(const std::vector<size_t>& bounds,
+                           ChunkSum body) override;
+
+    private:
+        size_t num_threads_;
+        tbb::task_arena arena_;
+};
@@ -0,0 +1,60 @@
+#include "Telemetry.hpp"
+
+#include <stdexcept>
+
+TelemetryWriter::TelemetryWriter(const std::string& file_path, Format format)
+    : file_(file_path), format_(format) {
+    if (!file_.is_open()) {
+        throw std::runtime_error("Could not open file");
+    }
+    if (format_ == Format::Csv) {
+        file_ << "engine,round,active_columns,additions,entries_merged,"
+                 "entries_cancelled,widen_events,bytes_copied,"
+                 "max_column_length,phase_seconds\n";
+    }
+}
+
+void TelemetryWriter::addRound(const RoundTelemetry& round) {
+    if (format_ == Format::Csv) {
+        file_ << round.engine << "," << round.round << ","
+              << round.active_columns << "," << round.additions << ","
+              << round.entries_merged << "," << round.entries_cancelled << ","
+              << round.widen_events << "," << round.bytes_copied << ","
+              << round.max_column_length << ",";
+        bool first = true;
+        for (const auto& [phase, seconds] : round.phase_seconds) {
+            file_ << (first ? "" : " ") << phase << "=" << seconds;
+            first = false;
+        }
+        file_ << "\n";
+        return;
+    }
+
+    file_ << "{\"engine\": \"" << round.engine << "\", \"round\": "
+          << round.round << ", \"active_columns\": " << round.active_columns
+          << ", \"additions\": " << round.additions
+          << ", \"entries_merged\": " << round.entries_merged
+          << ", \"entries_cancelled\": " << round.entries_cancelled
+          << ", \"widen_events\": " << round.widen_events
+          << ", \"bytes_copied\": " << round.bytes_copied
+          << ", \"max_column_length\": " << round.max_column_length
+          << ", \"phase_seconds\": {";
+    bool first = true;
+    for (const auto& [phase, seconds] : round.phase_seconds) {
+        file_ << (first ? "" : ", ") << "\"" << phase << "\": " << seconds;
+        first = false;
+    }
+    file_ << "}}\n";
+}
+
+#ifdef PH_TELEMETRY
+RoundClock::RoundClock(RoundTelemetry& round)
+    : round_(round), last_(std::chrono::steady_clock::now()) {}
+
+void RoundClock::lap(const char* phase) {
+    auto now = std::chrono::steady_clock::now();
+    round_.phase_seconds[phase] +=
+        std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+}
+#endif
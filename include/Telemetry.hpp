@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+
+// Per-round telemetry of a reduction. The engines only record it when built
+// with PH_TELEMETRY; otherwise the counting is compiled out and a sink never
+// receives anything.
+#ifdef PH_TELEMETRY
+#define PH_TELEMETRY_ONLY(...) __VA_ARGS__
+#else
+#define PH_TELEMETRY_ONLY(...)
+#endif
+
+struct RoundTelemetry {
+        std::string engine;
+        size_t round = 0;
+        // Columns that had an addition to do this round.
+        uint64_t active_columns = 0;
+        uint64_t additions = 0;
+        // Entries of both operands, summed over the additions, and how many
+        // of them cancelled.
+        uint64_t entries_merged = 0;
+        uint64_t entries_cancelled = 0;
+        // Columns moved to a bigger block plus reallocations of the row
+        // index array, and the bytes those reallocations and compaction
+        // copied.
+        uint64_t widen_events = 0;
+        uint64_t bytes_copied = 0;
+        uint64_t max_column_length = 0;
+        std::map<std::string, double> phase_seconds;
+};
+
+class TelemetrySink {
+    public:
+        virtual ~TelemetrySink() = default;
+
+        virtual void addRound(const RoundTelemetry& round) = 0;
+};
+
+// Writes one JSON object per line, or CSV with a header line and the phases
+// as "phase=seconds" pairs in the last field.
+class TelemetryWriter : public TelemetrySink {
+    public:
+        enum class Format { JsonLines, Csv };
+
+        TelemetryWriter(const std::string& file_path, Format format);
+
+        void addRound(const RoundTelemetry& round) override;
+
+    private:
+        std::ofstream file_;
+        Format format_;
+};
+
+#ifdef PH_TELEMETRY
+// Adds the time since construction, or since the last lap, to a phase of
+// round.
+class RoundClock {
+    public:
+        RoundClock(RoundTelemetry& round);
+
+        void lap(const char* phase);
+
+    private:
+        RoundTelemetry& round_;
+        std::chrono::steady_clock::time_point last_;
+};
+#endif
@@ -0,0 +1,74 @@
+#include "ThreadPool.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#if defined(PH_HAVE_NUMA)
+#include <numa.h>
+#endif
+
+namespace {
+
+size_t cgroupCpuQuota() {
+    std::ifstream cpu_max("/sys/fs/cgroup/cpu.max");
+    if (cpu_max.is_open()) {
+        std::string quota;
+        double period = 0;
+        if (cpu_max >> quota >> period && quota != "max" && period > 0) {
+            return std::ceil(std::stod(quota) / period);
+        }
+        return 0;
+    }
+
+    std::ifstream quota_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    std::ifstream period_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    double quota = 0;
+    double period = 0;
+    if (quota_file >> quota && period_file >> period && quota > 0 &&
+        period > 0) {
+        return std::ceil(quota / period);
+    }
+    return 0;
+}
+
+}  // namespace
+
+size_t ThreadPool::defaultThreadCount() {
+    if (const char* env = std::getenv("PH_NUM_THREADS")) {
+        size_t num_threads = std::strtoul(env, nullptr, 10);
+        if (num_threads > 0) {
+            return num_threads;
+        }
+    }
+
+    size_t num_threads = std::thread::hardware_concurrency();
+    size_t quota = cgroupCpuQuota();
+    if (quota > 0 && (num_threads == 0 || quota < num_threads)) {
+        num_threads = quota;
+    }
+    return num_threads > 0 ? num_threads : 1;
+}
+
+size_t ThreadPool::numaNodeCount() {
+#if defined(PH_HAVE_NUMA)
+    if (numa_available() >= 0) {
+        int nodes = numa_num_configured_nodes();
+        return nodes > 1 ? nodes : 1;
+    }
+#endif
+    return 1;
+}
+
+void ThreadPool::pinCurrentThread(size_t worker, size_t num_threads) {
+#if defined(PH_HAVE_NUMA)
+    size_t nodes = numaNodeCount();
+    if (nodes > 1) {
+        numa_run_on_node(worker * nodes / num_threads);
+    }
+#else
+    (void)worker;
+    (void)num_threads;
+#endif
+}
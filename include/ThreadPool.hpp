@@ -1,15 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
+
+#include "Trace.hpp"
 
 class ThreadPool {
     public:
-        ThreadPool(size_t num_threads = std::thread::hardware_concurrency()) {
+        ThreadPool(size_t num_threads = defaultThreadCount()) {
+            if (num_threads == 0) {
+                num_threads = 1;
+            }
             for (size_t i = 0; i < num_threads; i++) {
-                threads_.emplace_back([this] {
+                threads_.emplace_back([this, i, num_threads] {
+                    current_pool_ = this;
+                    current_worker_ = i;
+                    pinCurrentThread(i, num_threads);
+
                     while (true) {
                         std::function<void()> task;
                         {
@@ -27,12 +43,16 @@ class ThreadPool {
                             tasks_.pop();
                         }
 
+                        TraceScope span("task");
                         task();
                     }
                 });
             }
         }
 
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
         ~ThreadPool() {
             {
                 std::unique_lock<std::mutex> lock(queue_mutex_);
@@ -54,7 +74,110 @@ class ThreadPool {
             cv_.notify_one();
         }
 
+        size_t size() const { return threads_.size(); }
+
+        // Runs body(bounds[c], bounds[c + 1]) for every chunk c. Chunks are
+        // split into contiguous runs, one per worker plus one for the calling
+        // thread, so a given range of chunks lands on the same thread in
+        // every call. A thread that finishes its own run takes unclaimed
+        // chunks from the others, so uneven chunks balance themselves out.
+        template <typename Body>
+        void parallelFor(const std::vector<size_t>& bounds, Body&& body) {
+            if (bounds.size() < 2) {
+                return;
+            }
+
+            auto state = std::make_shared<ParallelForState>(
+                bounds.size() - 1, threads_.size() + 1);
+            size_t runners = std::min(threads_.size(), state->chunk_count - 1);
+            for (size_t i = 0; i < runners; i++) {
+                enqueue([this, state, &bounds, &body] {
+                    runChunks(*state, participantIndex(), bounds, body);
+                });
+            }
+            runChunks(*state, participantIndex(), bounds, body);
+
+            while (state->done_chunks.load(std::memory_order_acquire) <
+                   state->chunk_count) {
+                std::this_thread::yield();
+            }
+            if (state->error) {
+                std::rethrow_exception(state->error);
+            }
+        }
+
+        // PH_NUM_THREADS if set, otherwise the cgroup CPU quota or the number
+        // of hardware threads, whichever is smaller.
+        static size_t defaultThreadCount();
+
+        // 1 unless built with libnuma and running on a multi-node machine.
+        static size_t numaNodeCount();
+
     private:
+        struct alignas(64) ChunkRun {
+            std::atomic<size_t> next;
+            size_t end;
+        };
+
+        struct ParallelForState {
+            ParallelForState(size_t chunk_count, size_t participants)
+                : chunk_count(chunk_count), runs(participants) {
+                for (size_t p = 0; p < participants; p++) {
+                    runs[p].next.store(chunk_count * p / participants,
+                                       std::memory_order_relaxed);
+                    runs[p].end = chunk_count * (p + 1) / participants;
+                }
+            }
+
+            const size_t chunk_count;
+            std::vector<ChunkRun> runs;
+            std::atomic<size_t> done_chunks = 0;
+            std::mutex error_mutex;
+            std::exception_ptr error;
+        };
+
+        // A runner that starts after every chunk has been claimed returns
+        // without touching bounds or body, which may no longer exist.
+        template <typename Body>
+        static void runChunks(ParallelForState& state, size_t participant,
+                              const std::vector<size_t>& bounds, Body& body) {
+            size_t participants = state.runs.size();
+            for (size_t k = 0; k < participants; k++) {
+                ChunkRun& run = state.runs[(participant + k) % participants];
+                while (true) {
+                    size_t chunk =
+                        run.next.fetch_add(1, std::memory_order_relaxed);
+                    if (chunk >= run.end) {
+                        break;
+                    }
+
+                    try {
+                        TraceScope span("chunk", bounds[chunk],
+                                        bounds[chunk + 1]);
+                        body(bounds[chunk], bounds[chunk + 1]);
+                    } catch (...) {
+                        std::unique_lock<std::mutex> lock(state.error_mutex);
+                        if (!state.error) {
+                            state.error = std::current_exception();
+                        }
+                    }
+                    state.done_chunks.fetch_add(1, std::memory_order_release);
+                }
+            }
+        }
+
+        size_t participantIndex() const {
+            return current_pool_ == this ? current_worker_ : threads_.size();
+        }
+
+        // Binds worker to a NUMA node, consecutive workers sharing a node, so
+        // that the chunk runs they own keep their memory local. No-op on
+        // single-node machines.
+        static void pinCurrentThread(size_t worker, size_t num_threads);
+
+        inline static thread_local const ThreadPool* current_pool_ = nullptr;
+        inline static thread_local size_t current_worker_ = 0;
+
         std::vector<std::thread> threads_;
         std::queue<std::function<void()>> tasks_;
         std::mutex queue_mutex_;
@@ -0,0 +1,28 @@
+#include "ThreadPoolBackend.hpp"
+
+#include <atomic>
+
+ThreadPoolBackend::ThreadPoolBackend(std::shared_ptr<ThreadPool> pool)
+    : pool_(std::move(pool)) {
+    if (!pool_) {
+        pool_ = std::make_shared<ThreadPool>();
+    }
+}
+
+std::string ThreadPoolBackend::name() const { return "threadpool"; }
+
+size_t ThreadPoolBackend::concurrency() const { return pool_->size() + 1; }
+
+void ThreadPoolBackend::runChunks(const std::vector<size_t>& bounds,
+                                  ChunkBody body) {
+    pool_->parallelFor(bounds, body);
+}
+
+uint64_t ThreadPoolBackend::sumChunks(const std::vector<size_t>& bounds,
+                                      ChunkSum body) {
+    std::atomic<uint64_t> sum = 0;
+    pool_->parallelFor(bounds, [&](size_t start, size_t end) {
+        sum.fetch_add(body(start, end), std::memory_order_relaxed);
+    });
+    return sum.load();
+}
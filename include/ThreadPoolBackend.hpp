@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+
+#include "ExecutionBackend.hpp"
+#include "ThreadPool.hpp"
+
+class ThreadPoolBackend : public ExecutionBackend {
+    public:
+        ThreadPoolBackend(std::shared_ptr<ThreadPool> pool = nullptr);
+
+        std::string name() const override;
+
+        size_t concurrency() const override;
+
+    protected:
+        void runChunks(const std::vector<size_t>& bounds,
+                       ChunkBody body) override;
+
+        uint64_t sumChunks(const std::vector<size_t>& bounds,
+                           ChunkSum body) override;
+
+    private:
+        std::shared_ptr<ThreadPool> pool_;
+};
@@ -0,0 +1,127 @@
+#include "Trace.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Span {
+        const char* name;
+        Trace::Clock::time_point begin;
+        Trace::Clock::time_point end;
+        uint64_t first;
+        uint64_t last;
+};
+
+// Filled only by its own thread. written counts every span ever recorded and
+// is published with release, so the writer at exit sees every span it
+// counts.
+struct SpanBuffer {
+        static constexpr size_t capacity = 1 << 16;
+
+        std::vector<Span> spans = std::vector<Span>(capacity);
+        std::atomic<uint64_t> written = 0;
+};
+
+struct TraceState {
+        std::mutex mutex;
+        // Outlive their threads, so that spans of finished workers are still
+        // written.
+        std::vector<std::unique_ptr<SpanBuffer>> buffers;
+        std::string file_path;
+        Trace::Clock::time_point origin;
+};
+
+// Never destroyed, as threads may record until the trace is written.
+TraceState& traceState() {
+    static TraceState* state = new TraceState();
+    return *state;
+}
+
+thread_local SpanBuffer* thread_buffer = nullptr;
+
+SpanBuffer& threadBuffer() {
+    if (!thread_buffer) {
+        TraceState& state = traceState();
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.buffers.push_back(std::make_unique<SpanBuffer>());
+        thread_buffer = state.buffers.back().get();
+    }
+    return *thread_buffer;
+}
+
+double microseconds(Trace::Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+}  // namespace
+
+void Trace::enable(const std::string& file_path) {
+    TraceState& state = traceState();
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        bool first_enable = state.file_path.empty();
+        state.file_path = file_path;
+        if (!first_enable) {
+            return;
+        }
+        state.origin = Clock::now();
+    }
+    std::atexit(write);
+    enabled_.store(true);
+}
+
+void Trace::record(const char* name, Clock::time_point begin, uint64_t first,
+                   uint64_t last) {
+    SpanBuffer& buffer = threadBuffer();
+    uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    buffer.spans[index % SpanBuffer::capacity] = {name, begin, Clock::now(),
+                                                  first, last};
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+void Trace::write() {
+    enabled_.store(false);
+    TraceState& state = traceState();
+    std::unique_lock<std::mutex> lock(state.mutex);
+    std::ofstream file(state.file_path);
+    if (!file.is_open()) {
+        std::cerr << "Could not write trace to " << state.file_path << "\n";
+        return;
+    }
+
+    file << std::fixed << std::setprecision(3)
+         << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first_event = true;
+    for (size_t tid = 0; tid < state.buffers.size(); tid++) {
+        const SpanBuffer& buffer = *state.buffers[tid];
+        file << (first_event ? "" : ",")
+             << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                "\"tid\": "
+             << tid << ", \"args\": {\"name\": \"thread " << tid << "\"}}";
+        first_event = false;
+
+        uint64_t written = buffer.written.load(std::memory_order_acquire);
+        uint64_t start = written > SpanBuffer::capacity
+                             ? written - SpanBuffer::capacity
+                             : 0;
+        for (uint64_t i = start; i < written; i++) {
+            const Span& span = buffer.spans[i % SpanBuffer::capacity];
+            file << ",\n{\"name\": \"" << span.name
+                 << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+                 << ", \"ts\": " << microseconds(span.begin - state.origin)
+                 << ", \"dur\": " << microseconds(span.end - span.begin);
+            if (span.first != no_bounds) {
+                file << ", \"args\": {\"first\": " << span.first
+                     << ", \"last\": " << span.last << "}";
+            }
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+// Timeline of thread pool tasks and chunks and of backend phases, written at
+// exit as Chrome trace event JSON for Perfetto or chrome://tracing. Each
+// thread records into a ring buffer of its own, so recording takes no lock;
+// a full buffer overwrites its oldest spans. Disabled, a span costs one
+// relaxed load.
+class Trace {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr uint64_t no_bounds =
+            std::numeric_limits<uint64_t>::max();
+
+        // Starts recording. The trace is written to file_path when the
+        // process exits.
+        static void enable(const std::string& file_path);
+
+        static bool enabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        // Records a span named name, which must live as long as the process,
+        // from begin until now on the calling thread. first and last, if
+        // given, are the column bounds of a chunk.
+        static void record(const char* name, Clock::time_point begin,
+                           uint64_t first = no_bounds,
+                           uint64_t last = no_bounds);
+
+    private:
+        static void write();
+
+        inline static std::atomic<bool> enabled_ = false;
+};
+
+// Records a span for the lifetime of the scope while tracing is enabled.
+class TraceScope {
+    public:
+        TraceScope(const char* name, uint64_t first = Trace::no_bounds,
+                   uint64_t last = Trace::no_bounds)
+            : name_(name), first_(first), last_(last),
+              active_(Trace::enabled()) {
+            if (active_) {
+                begin_ = Trace::Clock::now();
+            }
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+        ~TraceScope() {
+            if (active_) {
+                Trace::record(name_, begin_, first_, last_);
+            }
+        }
+
+    private:
+        const char* name_;
+        uint64_t first_;
+        uint64_t last_;
+        bool active_;
+        Trace::Clock::time_point begin_;
+};
@@ -74,7 +74,7 @@ kernel void count_to_add(
 kernel void copy_to_new_start(device const uint32_t* row_index,
                               device uint32_t* col_start,
                               device uint32_t* col_end,
-                              device uint32_t* row_index_buffer,
+                              device uint32_t* new_row_index,
                               device uint32_t* new_col_start,
                               uint i [[thread_position_in_grid]]) {
     uint32_t start = col_start[i];
@@ -82,17 +82,21 @@ kernel void copy_to_new_start(device const uint32_t* row_index,
     uint32_t new_start = new_col_start[i];
 
     for (uint32_t j = 0; j < end - start; j++) {
-        row_index_buffer[new_start + j] = row_index[start + j];
+        new_row_index[new_start + j] = row_index[start + j];
     }
 
     col_start[i] = new_start;
     col_end[i] = new_start + (end - start);
 }
 
-kernel void add_columns(device const uint32_t* col_start,
-                        device uint32_t* col_end, device uint32_t* row_index,
-                        device uint32_t* row_index_buffer,
-                        device uint32_t* to_add, device const uint32_t* n,
+// Both columns end in the same low, which cancels, so the rest of the sum
+// fits in add_to's room; count_to_add widens the buffer whenever it does not.
+// It is merged from the back into the top of that room, which needs no
+// second buffer. Rows that cancel leave a gap below the sum, and moving
+// col_start up over the gap hands it to the previous column as slack.
+kernel void add_columns(device uint32_t* col_start, device uint32_t* col_end,
+                        device uint32_t* row_index,
+                        device const uint32_t* to_add, device const uint32_t* n,
                         uint add_to [[thread_position_in_grid]]) {
     if (to_add[add_to] == *n) {
         return;
@@ -100,39 +104,43 @@ kernel void add_columns(device const uint32_t* col_start,
 
     uint32_t add_from = to_add[add_to];
 
-    uint32_t end1 = col_end[add_to];
-    uint32_t end2 = col_end[add_from];
-
-    uint32_t i = col_start[add_to];
-    uint32_t j = col_start[add_from];
-    uint32_t k = col_start[add_to];
-    while (i < end1 && j < end2) {
-        if (row_index[i] < row_index[j]) {
-            row_index_buffer[k] = row_index[i];
-            i++;
-            k++;
-        } else if (row_index[i] > row_index[j]) {
-            row_index_buffer[k] = row_index[j];
-            j++;
-            k++;
+    uint32_t start1 = col_start[add_to];
+    uint32_t start2 = col_start[add_from];
+    uint32_t i = col_end[add_to] - 1;
+    uint32_t j = col_end[add_from] - 1;
+    uint32_t end = i + (j - start2);
+    uint32_t k = end;
+    while (i > start1 && j > start2) {
+        if (row_index[i - 1] > row_index[j - 1]) {
+            k--;
+            i--;
+            row_index[k] = row_index[i];
+        } else if (row_index[i - 1] < row_index[j - 1]) {
+            k--;
+            j--;
+            row_index[k] = row_index[j];
         } else {
-            i++;
-            j++;
+            i--;
+            j--;
         }
     }
-    while (i < end1) {
-        row_index_buffer[k] = row_index[i];
-        i++;
-        k++;
+    while (j > start2) {
+        k--;
+        j--;
+        row_index[k] = row_index[j];
     }
-    while (j < end2) {
-        row_index_buffer[k] = row_index[j];
-        j++;
-        k++;
+    if (k == i) {
+        // Nothing but the low cancelled: the rest of add_to is in place.
+        k = start1;
+    } else {
+        // Otherwise it moves up by twice the number of rows that did.
+        while (i > start1) {
+            k--;
+            i--;
+            row_index[k] = row_index[i];
+        }
     }
 
-    for (uint32_t i = col_start[add_to]; i < k; i++) {
-        row_index[i] = row_index_buffer[i];
-    }
-    col_end[add_to] = k;
+    col_start[add_to] = k;
+    col_end[add_to] = end;
 }
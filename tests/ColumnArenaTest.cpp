@@ -0,0 +1,139 @@
+#include <vector>
+
+#include "ColumnArena.hpp"
+#include "ExecutionBackend.hpp"
+#include "Test.hpp"
+
+namespace {
+
+using Arena = ColumnArena<uint32_t, uint32_t>;
+
+// Packs columns into an arena with no room to spare.
+void assignColumns(Arena& arena,
+                   const std::vector<std::vector<uint32_t>>& columns,
+                   RowEncoding encoding = RowEncoding::Wide) {
+    Arena::RowVector row_index;
+    Arena::OffsetVector col_start;
+    Arena::OffsetVector col_end;
+    for (const auto& column : columns) {
+        col_start.push_back(row_index.size());
+        row_index.insert(row_index.end(), column.begin(), column.end());
+        col_end.push_back(row_index.size());
+    }
+    arena.assign(std::move(row_index), std::move(col_start),
+                 std::move(col_end), encoding);
+}
+
+}  // namespace
+
+PH_TEST(columnMovesAloneWhenItOutgrowsItsBlock) {
+    Arena arena;
+    assignColumns(arena, {{0}, {0, 1}, {1, 2}, {0, 3}});
+    auto workspace = arena.borrowWorkspace();
+
+    // {0, 1} + {1, 2} fits column 1's block; {0, 3} + {0, 2} does not fit
+    // column 3's until the arena grows.
+    PH_CHECK(arena.addColumn(1, 2, *workspace));
+    PH_CHECK(arena.length(1) == 2 && arena.low(1) == 2);
+    PH_CHECK(!arena.addColumn(3, 2, *workspace));
+    PH_CHECK(arena.length(3) == 2 && arena.low(3) == 3);
+
+    workspace.reset();
+    arena.reserve(Arena::blockSize(4));
+    workspace = arena.borrowWorkspace();
+    PH_CHECK(arena.addColumn(3, 2, *workspace));
+    PH_CHECK(arena.length(3) == 4 && arena.low(3) == 3);
+    PH_CHECK(arena.capacity(3) == Arena::blockSize(4));
+    PH_CHECK(arena.length(0) == 1 && arena.low(0) == 0);
+    PH_CHECK(arena.length(2) == 2 && arena.low(2) == 2);
+}
+
+PH_TEST(freedBlocksAreReused) {
+    Arena arena;
+    assignColumns(arena, {{0, 1, 2, 3}, {4}, {5}, {4, 5}});
+    auto workspace = arena.borrowWorkspace();
+    size_t capacity = arena.rowCapacity();
+
+    // Column 0's block of 4 is freed and split for column 1's block of 2.
+    arena.discard(0, *workspace);
+    PH_CHECK(arena.addColumn(1, 2, *workspace));
+    PH_CHECK(arena.length(1) == 2 && arena.low(1) == 5);
+    PH_CHECK(arena.rowCapacity() == capacity);
+
+    // A column that cancels out keeps its block.
+    PH_CHECK(arena.addColumn(3, 1, *workspace));
+    PH_CHECK(arena.length(3) == 0 && arena.low(3) == arena.columnCount());
+}
+
+PH_TEST(compactionKeepsEveryColumn) {
+    // Columns 0 to 7 grow by adding 8 to 15, which are then discarded, so
+    // most of the arena ends up as waste. 16 to 23 are copies of what 0 to
+    // 7 become, to compare them with afterwards.
+    std::vector<std::vector<uint32_t>> columns;
+    for (uint32_t i = 0; i < 8; i++) {
+        columns.push_back({i, 100 + i});
+    }
+    for (uint32_t i = 0; i < 8; i++) {
+        columns.push_back({20 + i, 30 + i, 40 + i});
+    }
+    for (uint32_t i = 0; i < 8; i++) {
+        columns.push_back({i, 20 + i, 30 + i, 40 + i, 100 + i});
+    }
+    auto backend = makeExecutionBackend("threadpool", 4);
+    for (ExecutionBackend* compact_backend : {(ExecutionBackend*)nullptr,
+                                              backend.get()}) {
+        Arena arena;
+        assignColumns(arena, columns);
+        arena.reserve(64);
+        {
+            auto workspace = arena.borrowWorkspace();
+            for (size_t i = 0; i < 8; i++) {
+                PH_CHECK(arena.addColumn(i, 8 + i, *workspace));
+                arena.discard(8 + i, *workspace);
+            }
+        }
+        size_t capacity = arena.rowCapacity();
+        PH_CHECK(!arena.compactIfFragmented(compact_backend, 0.9));
+        PH_CHECK(arena.compactIfFragmented(compact_backend, 0.2));
+        PH_CHECK(arena.rowCapacity() < capacity);
+
+        auto workspace = arena.borrowWorkspace();
+        for (size_t i = 0; i < 8; i++) {
+            PH_CHECK(arena.length(i) == 5 && arena.low(i) == 100 + i);
+            PH_CHECK(arena.length(8 + i) == 0);
+            PH_CHECK(arena.addColumn(16 + i, i, *workspace));
+            PH_CHECK(arena.length(16 + i) == 0);
+        }
+    }
+}
+
+PH_TEST(compactColumnsSwitchEncodingAsTheyChange) {
+    // Rows 70000 and up are in the second 65536-row window, so 0, 3 and 5
+    // span windows and are stored wide while the others are compact.
+    Arena arena;
+    assignColumns(arena,
+                  {{10, 70000}, {70000, 70001, 70002}, {10, 20, 30},
+                   {10, 70001}, {70001, 70002}, {10, 20, 30, 70001}},
+                  RowEncoding::Compact);
+    auto workspace = arena.borrowWorkspace();
+    PH_CHECK(arena.length(0) == 2 && arena.low(0) == 70000);
+    PH_CHECK(arena.length(1) == 3 && arena.low(1) == 70002);
+    PH_CHECK(arena.length(2) == 3 && arena.low(2) == 30);
+
+    // Wide plus wide gives a compact column: {70000, 70001}.
+    arena.reserve(64);
+    PH_CHECK(arena.addColumn(0, 3, *workspace));
+    PH_CHECK(arena.length(0) == 2 && arena.low(0) == 70001);
+    // Compact plus compact in the same window, with odd lengths: {70000}.
+    PH_CHECK(arena.addColumn(1, 4, *workspace));
+    PH_CHECK(arena.length(1) == 1 && arena.low(1) == 70000);
+    // Compact columns from different windows give a wide one.
+    PH_CHECK(arena.addColumn(2, 1, *workspace));
+    PH_CHECK(arena.length(2) == 4 && arena.low(2) == 70000);
+    // And back to compact once the first window cancels out: {70000,
+    // 70001}.
+    PH_CHECK(arena.addColumn(5, 2, *workspace));
+    PH_CHECK(arena.length(5) == 2 && arena.low(5) == 70001);
+    PH_CHECK(arena.addColumn(0, 4, *workspace));
+    PH_CHECK(arena.length(0) == 2 && arena.low(0) == 70002);
+}
@@ -0,0 +1,113 @@
+#include <stdexcept>
+
+#include "ParallelSparseMatrix.hpp"
+#include "SparseMatrix.hpp"
+#include "Test.hpp"
+#include "TestMatrices.hpp"
+
+namespace {
+
+template <typename T>
+DefaultInitVector<T> toVector(const std::vector<uint64_t>& values) {
+    return DefaultInitVector<T>(values.begin(), values.end());
+}
+
+// Builds a sequential and a parallel engine over matrix moved in as
+// Offset and Row arrays.
+template <typename Offset, typename Row>
+void checkOwned(const TestMatrix& matrix, const std::string& what) {
+    Pairs expected = naiveReduction(matrix);
+    auto sequential = makeMatrix<SparseMatrix>(
+        matrix.n, toVector<Offset>(matrix.col_ptr),
+        toVector<Row>(matrix.row_index), ArenaOptions());
+    auto parallel = makeMatrix<ParallelSparseMatrix>(
+        matrix.n, toVector<Offset>(matrix.col_ptr),
+        toVector<Row>(matrix.row_index),
+        makeExecutionBackend("threadpool", 4), ArenaOptions());
+    checkPairs(reducePairs(*sequential, true), expected, what + " sparse");
+    checkPairs(reducePairs(*parallel, false), expected,
+               what + " sparse-parallel");
+}
+
+// Expects both engines to reject col_ptr and row_index, borrowed and moved
+// in alike. A span takes its row count from col_ptr, so it is only checked
+// when that matches.
+void checkRejected(size_t n, const std::vector<uint64_t>& col_ptr,
+                   const std::vector<uint64_t>& row_index) {
+    PH_CHECK_THROWS(
+        makeMatrix<SparseMatrix>(n, toVector<uint32_t>(col_ptr),
+                                 toVector<uint32_t>(row_index),
+                                 ArenaOptions()),
+        std::runtime_error);
+    PH_CHECK_THROWS(
+        makeMatrix<ParallelSparseMatrix>(
+            n, toVector<uint64_t>(col_ptr), toVector<uint32_t>(row_index),
+            makeExecutionBackend("threadpool", 2), ArenaOptions()),
+        std::runtime_error);
+    if (col_ptr.size() == n + 1 && col_ptr[n] == row_index.size()) {
+        CscSpan<uint64_t, uint64_t> span{n, col_ptr.data(), row_index.data()};
+        PH_CHECK_THROWS(makeMatrix<SparseMatrix>(span, ArenaOptions()),
+                        std::runtime_error);
+    }
+}
+
+}  // namespace
+
+PH_TEST(borrowedCscMatchesNaiveReduction) {
+    for (uint32_t seed = 1; seed <= 3; seed++) {
+        TestMatrix matrix = randomComplex(20 + 2 * seed, 0.6, 3, 0, seed);
+        Pairs expected = naiveReduction(matrix);
+        std::vector<uint64_t> col_ptr_copy = matrix.col_ptr;
+        std::vector<uint64_t> row_index_copy = matrix.row_index;
+
+        auto sequential =
+            makeMatrix<SparseMatrix>(matrix.span(), ArenaOptions());
+        auto parallel = makeMatrix<ParallelSparseMatrix>(
+            matrix.span(), makeExecutionBackend("threadpool", 4),
+            ArenaOptions());
+        checkPairs(reducePairs(*sequential, true), expected, "borrowed");
+        checkPairs(reducePairs(*parallel, true), expected,
+                   "borrowed parallel");
+
+        // Narrower input types than the matrix picks.
+        std::vector<uint32_t> col_ptr(matrix.col_ptr.begin(),
+                                      matrix.col_ptr.end());
+        std::vector<uint32_t> row_index(matrix.row_index.begin(),
+                                        matrix.row_index.end());
+        CscSpan<uint32_t, uint32_t> narrow{matrix.n, col_ptr.data(),
+                                           row_index.data()};
+        auto from_narrow = makeMatrix<SparseMatrix>(narrow, ArenaOptions());
+        checkPairs(reducePairs(*from_narrow, false), expected,
+                   "borrowed 32-bit");
+
+        // The reductions work on copies.
+        PH_CHECK(matrix.col_ptr == col_ptr_copy);
+        PH_CHECK(matrix.row_index == row_index_copy);
+    }
+}
+
+PH_TEST(ownedCscMatchesNaiveReduction) {
+    for (uint32_t seed = 1; seed <= 3; seed++) {
+        TestMatrix matrix = randomComplex(20 + 2 * seed, 0.6, 3, 0, seed);
+        std::string what = "seed " + std::to_string(seed);
+        checkOwned<uint32_t, uint32_t>(matrix, what);
+        checkOwned<uint64_t, uint32_t>(matrix, what + " 64-bit offsets");
+        checkOwned<uint64_t, uint64_t>(matrix, what + " 64-bit rows");
+    }
+}
+
+PH_TEST(invalidCscIsRejected) {
+    // Each case breaks three vertices and the edge {0, 1}, which are
+    // col_ptr {0, 0, 0, 0, 2} and row_index {0, 1}.
+    // Too few and too many column pointers.
+    checkRejected(4, {0, 0, 0, 2}, {0, 1});
+    checkRejected(4, {0, 0, 0, 0, 0, 2}, {0, 1});
+    // Not starting at 0, decreasing, or not ending at the row count.
+    checkRejected(4, {1, 1, 1, 1, 2}, {0, 1});
+    checkRejected(4, {0, 1, 0, 0, 2}, {0, 1});
+    checkRejected(4, {0, 0, 0, 0, 1}, {0, 1});
+    // Rows out of order, repeated, or past the last column.
+    checkRejected(4, {0, 0, 0, 0, 2}, {1, 0});
+    checkRejected(4, {0, 0, 0, 0, 2}, {1, 1});
+    checkRejected(4, {0, 0, 0, 0, 2}, {0, 4});
+}
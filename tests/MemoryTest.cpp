@@ -0,0 +1,170 @@
+#include <filesystem>
+#include <memory>
+
+#include "MemoryResource.hpp"
+#include "Test.hpp"
+#include "TestMatrices.hpp"
+
+namespace {
+
+std::string tempDirectory() {
+    return std::filesystem::temp_directory_path().string();
+}
+
+// Reduces matrix with every CPU engine under options and checks the pairs.
+void checkEngines(const TestMatrix& matrix, const ArenaOptions& options,
+                  const std::string& what) {
+    Pairs expected = naiveReduction(matrix);
+    IndexWidths widths = chooseIndexWidths(matrix.n, matrix.row_index.size());
+    for (const TestEngine& engine : testEngines()) {
+        auto reduced = engine.make(matrix, widths, options);
+        checkPairs(reducePairs(*reduced, true), expected,
+                   what + " on " + engine.name);
+    }
+}
+
+}  // namespace
+
+PH_TEST(spilledRowsMatchNaiveReduction) {
+    // Without a budget, the row index array lives in spill files from the
+    // start.
+    ArenaOptions options;
+    options.spill_memory =
+        std::make_shared<MappedFileResource>(tempDirectory());
+    for (uint32_t seed = 1; seed <= 3; seed++) {
+        checkEngines(randomComplex(20 + 2 * seed, 0.6, 3, 0, seed), options,
+                     "spilled, seed " + std::to_string(seed));
+    }
+    options.encoding = RowEncoding::Compact;
+    checkEngines(randomComplex(24, 0.6, 3, 0, 4), options,
+                 "spilled compact");
+}
+
+PH_TEST(spillFilesHoldWhatIsWritten) {
+    MappedFileResource spill(tempDirectory());
+    size_t bytes = 3 << 20;
+    auto* words = static_cast<uint32_t*>(spill.allocate(bytes));
+    for (size_t i = 0; i < bytes / sizeof(uint32_t); i++) {
+        words[i] = i;
+    }
+    spill.advise(words, bytes, MemoryAdvice::DontNeed);
+    bool intact = true;
+    for (size_t i = 0; i < bytes / sizeof(uint32_t); i++) {
+        intact = intact && words[i] == i;
+    }
+    spill.deallocate(words, bytes);
+    PH_CHECK(intact);
+    PH_CHECK_THROWS(MappedFileResource("/nonexistent-ph-dir").allocate(4096),
+                    std::runtime_error);
+}
+
+PH_TEST(budgetIsReleasedAfterReduction) {
+    TestMatrix matrix = randomComplex(30, 0.6, 3, 0, 7);
+    Pairs expected = naiveReduction(matrix);
+    IndexWidths widths = chooseIndexWidths(matrix.n, matrix.row_index.size());
+    for (const TestEngine& engine : testEngines()) {
+        ArenaOptions options;
+        auto budget = std::make_shared<MemoryBudget>(16 << 20);
+        options.memory = budget;
+        {
+            auto reduced = engine.make(matrix, widths, options);
+            checkPairs(reducePairs(*reduced, true), expected, engine.name);
+        }
+        PH_CHECK(budget->peak() > 0 && budget->peak() <= budget->limit());
+        PH_CHECK(budget->current() == 0);
+    }
+}
+
+PH_TEST(budgetTooSmallFailsCleanly) {
+    // This matrix needs about 200KB within a budget, or 75KB when its rows
+    // can spill.
+    TestMatrix matrix = randomComplex(30, 0.6, 3, 0, 7);
+    Pairs expected = naiveReduction(matrix);
+    IndexWidths widths = chooseIndexWidths(matrix.n, matrix.row_index.size());
+    const uint64_t limit = 100 << 10;
+    for (const TestEngine& engine : testEngines()) {
+        ArenaOptions options;
+        auto budget = std::make_shared<MemoryBudget>(limit);
+        options.memory = budget;
+        PH_CHECK_THROWS(reducePairs(*engine.make(matrix, widths, options),
+                                    true),
+                        MemoryBudgetExceeded);
+        PH_CHECK(budget->current() == 0);
+
+        budget = std::make_shared<MemoryBudget>(limit);
+        options.memory = budget;
+        options.spill_memory =
+            std::make_shared<MappedFileResource>(tempDirectory());
+        {
+            auto reduced = engine.make(matrix, widths, options);
+            checkPairs(reducePairs(*reduced, true), expected,
+                       "spilling " + engine.name);
+        }
+        PH_CHECK(budget->peak() <= limit);
+        PH_CHECK(budget->current() == 0);
+    }
+}
+
+PH_TEST(budgetCapsItsUpstream) {
+    MemoryBudget budget(1000);
+    void* a = budget.allocate(600);
+    PH_CHECK(!budget.fits(600) && budget.fits(400));
+    PH_CHECK_THROWS(budget.allocate(600), MemoryBudgetExceeded);
+    PH_CHECK(budget.current() == 600);
+    void* b = budget.allocate(400);
+    budget.deallocate(a, 600);
+    budget.deallocate(b, 400);
+    PH_CHECK(budget.current() == 0 && budget.peak() == 1000);
+}
+
+PH_TEST(hugePageMappingsAreUnmapped) {
+    const size_t mb = 1 << 20;
+    size_t mapped_before = HugePageResource::mappedBytes();
+    {
+        HugePageResource huge_pages;
+        // A 5MB array reuses the 8MB mapping of a freed 7MB one, and must
+        // give all 8MB back.
+        void* first = huge_pages.allocate(7 * mb);
+        PH_CHECK((uintptr_t)first % HugePageResource::huge_page_size == 0);
+        huge_pages.deallocate(first, 7 * mb);
+        void* reused = huge_pages.allocate(5 * mb);
+        PH_CHECK(reused == first);
+        huge_pages.deallocate(reused, 5 * mb);
+        PH_CHECK(HugePageResource::mappedBytes() == mapped_before + 8 * mb);
+
+        // Growing and shrinking, as the arena does.
+        for (size_t k = 0; k < 20; k++) {
+            size_t grown = (6 + k % 3) * mb;
+            void* ptr = huge_pages.allocate(grown);
+            huge_pages.deallocate(ptr, grown);
+            ptr = huge_pages.allocate(4 * mb);
+            huge_pages.deallocate(ptr, 4 * mb);
+        }
+    }
+    PH_CHECK(HugePageResource::mappedBytes() == mapped_before);
+
+    // Past max_cached, freed mappings are unmapped at once.
+    {
+        HugePageResource huge_pages(0);
+        void* ptr = huge_pages.allocate(3 * mb);
+        PH_CHECK(HugePageResource::mappedBytes() == mapped_before + 4 * mb);
+        huge_pages.deallocate(ptr, 3 * mb);
+        PH_CHECK(HugePageResource::mappedBytes() == mapped_before);
+    }
+}
+
+PH_TEST(hugePagesMatchNaiveReduction) {
+    size_t mapped_before = HugePageResource::mappedBytes();
+    {
+        ArenaOptions options;
+        auto budget = std::make_shared<MemoryBudget>(
+            0, std::make_shared<HugePageResource>());
+        options.memory = budget;
+        checkEngines(randomComplex(30, 0.6, 3, 0, 7), options, "huge pages");
+        options.encoding = RowEncoding::Compact;
+        checkEngines(randomComplex(30, 0.6, 3, 0, 8), options,
+                     "huge pages compact");
+        PH_CHECK(budget->current() == 0);
+    }
+    PH_CHECK(HugePageResource::mappedBytes() == mapped_before);
+}
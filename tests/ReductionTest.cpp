@@ -0,0 +1,175 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "ParallelSparseMatrix.hpp"
+#include "SparseMatrix.hpp"
+#include "Test.hpp"
+#include "TestMatrices.hpp"
+
+namespace {
+
+// Every CPU engine, with and without twist, on complexes whose columns
+// outgrow the packed input layout, so the arena relocates and grows.
+void checkEngines(const TestMatrix& matrix, const ArenaOptions& options,
+                  const std::string& what, const IndexWidths& widths) {
+    Pairs expected = naiveReduction(matrix);
+    for (const TestEngine& engine : testEngines()) {
+        for (bool twist : {false, true}) {
+            auto reduced = engine.make(matrix, widths, options);
+            checkPairs(reducePairs(*reduced, twist), expected,
+                       what + " on " + engine.name +
+                           (twist ? " with twist" : ""));
+        }
+    }
+}
+
+// With the index types makeMatrix picks for matrix.
+void checkEngines(const TestMatrix& matrix, const ArenaOptions& options,
+                  const std::string& what) {
+    checkEngines(matrix, options, what,
+                 chooseIndexWidths(matrix.n, matrix.row_index.size()));
+}
+
+}  // namespace
+
+PH_TEST(enginesMatchNaiveReduction) {
+    for (uint32_t seed = 1; seed <= 8; seed++) {
+        TestMatrix matrix = randomComplex(12 + 2 * seed, 0.6, 3, 0, seed);
+        checkEngines(matrix, {}, "seed " + std::to_string(seed));
+    }
+    // Enough columns for several chunks of the parallel engine.
+    checkEngines(randomComplex(40, 0.5, 3, 0, 9), {}, "seed 9");
+}
+
+PH_TEST(emptyAndTrivialMatrices) {
+    checkEngines(randomComplex(1, 0, 0, 0, 1), {}, "one vertex");
+    checkEngines(randomComplex(30, 0, 3, 0, 1), {}, "no edges");
+    checkEngines(randomComplex(8, 1, 7, 0, 1), {}, "full simplex");
+}
+
+PH_TEST(compactRowsMatchNaiveReduction) {
+    ArenaOptions options;
+    options.encoding = RowEncoding::Compact;
+    for (uint32_t seed = 1; seed <= 4; seed++) {
+        checkEngines(randomComplex(12 + 2 * seed, 0.6, 3, 0, seed), options,
+                     "compact seed " + std::to_string(seed));
+        // Isolated vertices first put the complex across the boundary of
+        // the first 65536-row window, so some columns span windows.
+        checkEngines(randomComplex(16 + seed, 0.7, 3, 65530, seed), options,
+                     "compact across windows, seed " + std::to_string(seed));
+    }
+}
+
+PH_TEST(wideIndexTypesMatchNaiveReduction) {
+    for (RowEncoding encoding : {RowEncoding::Wide, RowEncoding::Compact}) {
+        ArenaOptions options;
+        options.encoding = encoding;
+        for (uint32_t seed = 1; seed <= 3; seed++) {
+            TestMatrix matrix = randomComplex(14 + 2 * seed, 0.6, 3, 0, seed);
+            std::string what = "seed " + std::to_string(seed);
+            checkEngines(matrix, options, what + ", 64-bit offsets",
+                         {true, false});
+            checkEngines(matrix, options, what + ", 64-bit offsets and rows",
+                         {true, true});
+        }
+    }
+}
+
+PH_TEST(indexWidthsFollowTheMatrixSize) {
+    IndexWidths small = chooseIndexWidths(1000, 100000);
+    PH_CHECK(!small.wide_offsets && !small.wide_rows);
+    // Room for the row index array to grow 4x past the input.
+    IndexWidths many_entries = chooseIndexWidths(1000, (uint64_t)1 << 30);
+    PH_CHECK(many_entries.wide_offsets && !many_entries.wide_rows);
+    IndexWidths many_columns = chooseIndexWidths((uint64_t)1 << 32, 10);
+    PH_CHECK(many_columns.wide_offsets && many_columns.wide_rows);
+}
+
+PH_TEST(loadingFromFileMatchesNaiveReduction) {
+    TestMatrix matrix = randomComplex(20, 0.6, 3, 0, 5);
+    Pairs expected = naiveReduction(matrix);
+    std::string path =
+        (std::filesystem::temp_directory_path() / "ph-tests-input.txt")
+            .string();
+    {
+        std::ofstream file(path);
+        file << matrix.text();
+    }
+    auto backend = makeExecutionBackend("threadpool", 4);
+    auto sequential = makeMatrix<SparseMatrix>(path, ArenaOptions());
+    auto parallel =
+        makeMatrix<ParallelSparseMatrix>(path, backend, ArenaOptions());
+    std::istringstream input(matrix.text());
+    SparseMatrix<uint64_t, uint32_t> streamed(input);
+    std::filesystem::remove(path);
+    checkPairs(reducePairs(*sequential, true), expected, "sparse from file");
+    checkPairs(reducePairs(*parallel, true), expected,
+               "sparse-parallel from file");
+    checkPairs(reducePairs(streamed, true), expected, "sparse from stream");
+}
+
+namespace {
+
+// Fails as soon as a pair arrives out of death order.
+class DeathOrderCheck : public PairSink {
+    public:
+        void addPair(uint64_t birth, uint64_t death) override {
+            PH_CHECK(birth < death);
+            PH_CHECK(pairs == 0 || death > last_death);
+            last_death = death;
+            pairs++;
+        }
+
+        uint64_t last_death = 0;
+        size_t pairs = 0;
+};
+
+}  // namespace
+
+PH_TEST(pairsStreamInDeathOrder) {
+    for (uint32_t seed = 1; seed <= 4; seed++) {
+        TestMatrix matrix = randomComplex(30, 0.5, 3, 0, seed);
+        size_t expected = naiveReduction(matrix).size();
+        for (const TestEngine& engine : testEngines()) {
+            for (RowEncoding encoding :
+                 {RowEncoding::Wide, RowEncoding::Compact}) {
+                for (bool twist : {false, true}) {
+                    ArenaOptions options;
+                    options.encoding = encoding;
+                    auto reduced = engine.make(
+                        matrix,
+                        chooseIndexWidths(matrix.n, matrix.row_index.size()),
+                        options);
+                    DeathOrderCheck check;
+                    reduced->reduce(check, twist);
+                    PH_CHECK(check.pairs == expected);
+                }
+            }
+        }
+    }
+}
+
+PH_TEST(pairFileHoldsEveryPair) {
+    TestMatrix matrix = randomComplex(30, 0.5, 3, 0, 11);
+    Pairs expected = naiveReduction(matrix);
+    std::string path =
+        (std::filesystem::temp_directory_path() / "ph-tests-pairs.txt")
+            .string();
+    auto backend = makeExecutionBackend("threadpool", 4);
+    auto reduced = makeMatrix<ParallelSparseMatrix>(
+        matrix.span(), backend, ArenaOptions());
+    {
+        PairFileWriter writer(path);
+        reduced->reduce(writer, true);
+    }
+    Pairs written;
+    std::ifstream file(path);
+    uint64_t birth, death;
+    while (file >> birth >> death) {
+        written.emplace_back(birth, death);
+    }
+    file.close();
+    std::filesystem::remove(path);
+    checkPairs(written, expected, "pair file");
+}
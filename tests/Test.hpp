@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A minimal test registry for ph-tests. Each PH_TEST registers a function
+// that runs once; PH_CHECK throws TestFailure, which fails that test and
+// moves on to the next.
+
+class TestFailure : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+struct TestCase {
+        const char* name;
+        void (*run)();
+};
+
+std::vector<TestCase>& testCases();
+
+struct TestRegistration {
+        TestRegistration(const char* name, void (*run)()) {
+            testCases().push_back({name, run});
+        }
+};
+
+#define PH_TEST(name)                                                        \
+    static void name();                                                      \
+    static TestRegistration name##_registration(#name, name);                \
+    static void name()
+
+#define PH_CHECK(condition)                                                  \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            throw TestFailure(std::string(__FILE__) + ":" +                  \
+                              std::to_string(__LINE__) + ": " #condition);   \
+        }                                                                    \
+    } while (false)
+
+// Checks that statement throws Exception.
+#define PH_CHECK_THROWS(statement, Exception)                                \
+    do {                                                                     \
+        bool thrown = false;                                                 \
+        try {                                                                \
+            statement;                                                       \
+        } catch (const Exception&) {                                         \
+            thrown = true;                                                   \
+        }                                                                    \
+        if (!thrown) {                                                       \
+            throw TestFailure(std::string(__FILE__) + ":" +                  \
+                              std::to_string(__LINE__) +                     \
+                              ": no " #Exception " from " #statement);       \
+        }                                                                    \
+    } while (false)
@@ -0,0 +1,175 @@
+#include "TestMatrices.hpp"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <sstream>
+
+#include "ParallelSparseMatrix.hpp"
+#include "SparseMatrix.hpp"
+#include "Test.hpp"
+
+std::string TestMatrix::text() const {
+    std::ostringstream out;
+    out << n << "\n";
+    for (size_t i = 0; i < n; i++) {
+        for (uint64_t k = col_ptr[i]; k < col_ptr[i + 1]; k++) {
+            out << (k == col_ptr[i] ? "" : " ") << row_index[k];
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+TestMatrix randomComplex(size_t vertices, double edge_probability,
+                         size_t max_dim, size_t padding, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<std::vector<double>> weight(
+        vertices, std::vector<double>(vertices, -1));
+    for (size_t a = 0; a < vertices; a++) {
+        for (size_t b = a + 1; b < vertices; b++) {
+            if (uniform(random) < edge_probability) {
+                weight[a][b] = uniform(random);
+            }
+        }
+    }
+
+    // Every clique, grown one vertex at a time, with the largest weight of
+    // its edges.
+    struct Simplex {
+            double value;
+            std::vector<size_t> vertices;
+    };
+    std::vector<Simplex> simplices;
+    std::vector<Simplex> layer;
+    for (size_t v = 0; v < vertices; v++) {
+        layer.push_back({0, {v}});
+    }
+    for (size_t dim = 0; !layer.empty(); dim++) {
+        simplices.insert(simplices.end(), layer.begin(), layer.end());
+        if (dim == max_dim) {
+            break;
+        }
+        std::vector<Simplex> next;
+        for (const Simplex& simplex : layer) {
+            for (size_t v = simplex.vertices.back() + 1; v < vertices; v++) {
+                double value = simplex.value;
+                bool clique = true;
+                for (size_t u : simplex.vertices) {
+                    clique = clique && weight[u][v] >= 0;
+                    value = std::max(value, weight[u][v]);
+                }
+                if (clique) {
+                    Simplex coface = {value, simplex.vertices};
+                    coface.vertices.push_back(v);
+                    next.push_back(coface);
+                }
+            }
+        }
+        layer = std::move(next);
+    }
+    std::sort(simplices.begin(), simplices.end(),
+              [](const Simplex& a, const Simplex& b) {
+                  if (a.value != b.value) {
+                      return a.value < b.value;
+                  }
+                  if (a.vertices.size() != b.vertices.size()) {
+                      return a.vertices.size() < b.vertices.size();
+                  }
+                  return a.vertices < b.vertices;
+              });
+
+    TestMatrix matrix;
+    matrix.n = padding + simplices.size();
+    matrix.col_ptr.assign(padding + 1, 0);
+    std::map<std::vector<size_t>, uint64_t> index;
+    for (size_t s = 0; s < simplices.size(); s++) {
+        const std::vector<size_t>& simplex = simplices[s].vertices;
+        index[simplex] = padding + s;
+        std::vector<uint64_t> rows;
+        for (size_t drop = 0; simplex.size() > 1 && drop < simplex.size();
+             drop++) {
+            std::vector<size_t> face = simplex;
+            face.erase(face.begin() + drop);
+            rows.push_back(index.at(face));
+        }
+        std::sort(rows.begin(), rows.end());
+        matrix.row_index.insert(matrix.row_index.end(), rows.begin(),
+                                rows.end());
+        matrix.col_ptr.push_back(matrix.row_index.size());
+    }
+    return matrix;
+}
+
+Pairs naiveReduction(const TestMatrix& matrix) {
+    std::vector<std::vector<uint64_t>> columns(matrix.n);
+    std::map<uint64_t, size_t> pivot_of_low;
+    Pairs pairs;
+    for (size_t i = 0; i < matrix.n; i++) {
+        std::vector<uint64_t>& column = columns[i];
+        column.assign(matrix.row_index.begin() + matrix.col_ptr[i],
+                      matrix.row_index.begin() + matrix.col_ptr[i + 1]);
+        while (!column.empty() && pivot_of_low.count(column.back())) {
+            const std::vector<uint64_t>& pivot =
+                columns[pivot_of_low[column.back()]];
+            std::vector<uint64_t> sum;
+            std::set_symmetric_difference(column.begin(), column.end(),
+                                          pivot.begin(), pivot.end(),
+                                          std::back_inserter(sum));
+            column = std::move(sum);
+        }
+        if (!column.empty()) {
+            pivot_of_low[column.back()] = i;
+            pairs.emplace_back(column.back(), i);
+        }
+    }
+    return pairs;
+}
+
+Pairs reducePairs(IMatrix& matrix, bool run_twist) {
+    PairCollector collector;
+    matrix.reduce(collector, run_twist);
+    return collector.pairs;
+}
+
+void checkPairs(const Pairs& actual, const Pairs& expected,
+                const std::string& what) {
+    if (actual.size() != expected.size()) {
+        throw TestFailure(what + ": " + std::to_string(actual.size()) +
+                          " pairs, expected " +
+                          std::to_string(expected.size()));
+    }
+    for (size_t k = 0; k < actual.size(); k++) {
+        if (actual[k] != expected[k]) {
+            throw TestFailure(
+                what + ": pair " + std::to_string(k) + " is (" +
+                std::to_string(actual[k].first) + ", " +
+                std::to_string(actual[k].second) + "), expected (" +
+                std::to_string(expected[k].first) + ", " +
+                std::to_string(expected[k].second) + ")");
+        }
+    }
+}
+
+std::unique_ptr<IMatrix> TestEngine::make(const TestMatrix& matrix,
+                                          const IndexWidths& widths,
+                                          const ArenaOptions& options) const {
+    if (!backend) {
+        return makeMatrix<SparseMatrix>(widths, matrix.span(), options);
+    }
+    return makeMatrix<ParallelSparseMatrix>(widths, matrix.span(), backend,
+                                            options);
+}
+
+std::vector<TestEngine> testEngines() {
+    std::vector<TestEngine> engines = {{"sparse", nullptr}};
+    for (const std::string& name : availableExecutionBackends()) {
+        for (size_t threads : {1, 4}) {
+            engines.push_back({"sparse-parallel/" + name + "/" +
+                                   std::to_string(threads),
+                               makeExecutionBackend(name, threads)});
+        }
+    }
+    return engines;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ExecutionBackend.hpp"
+#include "IMatrix.hpp"
+#include "SparseMatrixBase.hpp"
+
+using Pairs = std::vector<std::pair<uint64_t, uint64_t>>;
+
+// Boundary matrix of a filtered simplicial complex, in CSC form.
+struct TestMatrix {
+        size_t n = 0;
+        std::vector<uint64_t> col_ptr = {0};
+        std::vector<uint64_t> row_index;
+
+        CscSpan<uint64_t, uint64_t> span() const {
+            return {n, col_ptr.data(), row_index.data()};
+        }
+
+        // In the input file format: n, then the rows of each column.
+        std::string text() const;
+};
+
+// Clique complex of a random graph on vertices vertices, up to max_dim, in
+// the order of random edge weights. The first padding columns are isolated
+// vertices, which pushes the rows of the complex up by padding.
+TestMatrix randomComplex(size_t vertices, double edge_probability,
+                         size_t max_dim, size_t padding, uint32_t seed);
+
+// Pairs of the textbook left-to-right column reduction, in death order.
+Pairs naiveReduction(const TestMatrix& matrix);
+
+// Collects pairs in the order they arrive.
+class PairCollector : public PairSink {
+    public:
+        void addPair(uint64_t birth, uint64_t death) override {
+            pairs.emplace_back(birth, death);
+        }
+
+        Pairs pairs;
+};
+
+Pairs reducePairs(IMatrix& matrix, bool run_twist);
+
+// Throws TestFailure naming what if the pairs differ, order included.
+void checkPairs(const Pairs& actual, const Pairs& expected,
+                const std::string& what);
+
+// A CPU engine with the backend it runs on, if any.
+struct TestEngine {
+        std::string name;
+        // Null for the sequential engine.
+        std::shared_ptr<ExecutionBackend> backend;
+
+        std::unique_ptr<IMatrix> make(const TestMatrix& matrix,
+                                      const IndexWidths& widths,
+                                      const ArenaOptions& options) const;
+};
+
+// The sequential engine, and the parallel engine on every available
+// backend with one thread and with four.
+std::vector<TestEngine> testEngines();
@@ -0,0 +1,35 @@
+#include <exception>
+#include <iostream>
+
+#include "Test.hpp"
+
+std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+// Runs every test, or those named on the command line, and exits with 1 if
+// any of them failed.
+int main(int argc, const char* argv[]) {
+    size_t failed = 0;
+    size_t ran = 0;
+    for (const TestCase& test : testCases()) {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; i++) {
+            selected = selected || test.name == std::string(argv[i]);
+        }
+        if (!selected) {
+            continue;
+        }
+        ran++;
+        try {
+            test.run();
+            std::cout << "ok " << test.name << "\n";
+        } catch (const std::exception& e) {
+            std::cout << "FAIL " << test.name << ": " << e.what() << "\n";
+            failed++;
+        }
+    }
+    std::cout << ran - failed << " of " << ran << " tests passed\n";
+    return failed > 0 ? 1 : 0;
+}